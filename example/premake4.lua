@@ -1,11 +1,32 @@
+newoption{
+	trigger = "native",
+	description = "Compile for this machine's CPU (-march=native) rather than picking the SIMD kernels at run time"
+}
+
 solution "Examples"
 	configurations{"debug", "release"}
+	if _OPTIONS["native"] then
+		buildoptions{"-march=native"}
+	end
 	project "DynMeansExample"
 		kind "ConsoleApp"
 		language "C++"
 		location "build"
 		files {"maindm.cpp"}
-		links {"lpsolve55"}
+		links {"lpsolve55", "pthread"}
+		includedirs{"/usr/local/include/eigen3", "/usr/local/include/dynmeans"}
+		configuration "debug"
+			flags{"Symbols", "ExtraWarnings"}
+			buildoptions{"-std=c++0x"}
+		configuration "release"
+			flags{"Optimize"}
+			buildoptions{"-std=c++0x"}
+	project "DynMeansTest"
+		kind "ConsoleApp"
+		language "C++"
+		location "build"
+		files {"testdm.cpp"}
+		links {"pthread", "rt"}
 		includedirs{"/usr/local/include/eigen3", "/usr/local/include/dynmeans"}
 		configuration "debug"
 			flags{"Symbols", "ExtraWarnings"}
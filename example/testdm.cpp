@@ -0,0 +1,958 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <numeric>
+#include <functional>
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <dynmeans/dynmeans.hpp>
+#include <dynmeans/sharded_dynmeans.hpp>
+#include <dynmeans/multidynmeans.hpp>
+
+using namespace std;
+
+typedef Eigen::Vector2d V2d;
+typedef DynMeans<V2d> DM;
+
+//checks of DynMeans against its default clustering: on fixed seeds, the exact options below must give the same labels
+//and objective as a serial run of the same chain, step after step. The whole suite also runs on the same data translated
+//by 1e6, where the cluster statistics must not lose precision (the objective has to be translation invariant), and the
+//chains of a MultiDynMeans are checked against DynMeans chains the same way. Exits with the number of failed checks
+
+//the labels and objective of every step of a chain
+struct ChainRun{
+	vector<vector<int> > lbls;
+	vector<double> objs;
+};
+typedef function<void(DM&)> SetupFn;
+typedef function<void(DM&, const vector<V2d>&, vector<int>&, vector<V2d>&, double&)> ClusterFn;
+
+const double lambda = 0.05, Q = lambda/6.8, tau = (6.8*(1.01-1.0)+1.0)/(6.8-1.0);
+const int nRestarts = 5, seed = 7;
+int nFailed = 0;
+//heap allocations made so far, to check that a reused ClusterWorkspace allocates nothing
+size_t nAllocs = 0;
+//(both kept out of line, or gcc takes an inlined malloc or free meeting the other operator for a mismatched pair)
+__attribute__((noinline)) void* operator new(size_t size){
+	nAllocs++;
+	void* p = malloc(size);
+	if (p == NULL){
+		throw bad_alloc();
+	}
+	return p;
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept{
+	free(p);
+}
+//relative tolerance for an objective recomputed from the labels: 1e6 away from the origin a coordinate is only exact to
+//about 1e-10, which is a few 1e-9 of the squared distance between neighbouring points
+double objectiveTol = 1.0e-9;
+
+//clusters that drift, die and are born, nCenters at a time on average, spread over a square whose area grows with them
+vector<vector<V2d> > generateSteps(int nSteps, double offset, int nCenters = 4){
+	mt19937 rng(5489u);
+	normal_distribution<double> nrm(0, 1);
+	uniform_real_distribution<double> unif(0, 1);
+	const double width = sqrt(nCenters/4.0);
+	vector<V2d> centers;
+	for (int k = 0; k < nCenters; k++){
+		centers.push_back(width*V2d(unif(rng), unif(rng)));
+	}
+	vector<vector<V2d> > steps(nSteps);
+	for (int t = 0; t < nSteps; t++){
+		if (t > 0){
+			for (int k = 0; k < centers.size(); k++){
+				centers[k] += 0.03*V2d(nrm(rng), nrm(rng));
+			}
+			for (int k = 0; k < nCenters/4; k++){
+				if (unif(rng) < 0.3){
+					centers.erase(centers.begin());
+				}
+				if (unif(rng) < 0.5){
+					centers.push_back(width*V2d(unif(rng), unif(rng)));
+				}
+			}
+		}
+		for (int k = 0; k < centers.size(); k++){
+			for (int i = 0; i < 15; i++){
+				steps[t].push_back(centers[k] + 0.05*V2d(nrm(rng), nrm(rng)) + V2d::Constant(offset));
+			}
+		}
+	}
+	return steps;
+}
+
+ChainRun runChain(const vector<vector<V2d> >& steps, SetupFn setup, ClusterFn clusterFn){
+	DM dynm(lambda, Q, tau, false, seed);
+	setup(dynm);
+	ChainRun run;
+	for (int t = 0; t < steps.size(); t++){
+		vector<int> lbls;
+		vector<V2d> prms;
+		double obj;
+		clusterFn(dynm, steps[t], lbls, prms, obj);
+		run.lbls.push_back(lbls);
+		run.objs.push_back(obj);
+	}
+	return run;
+}
+
+//renumbers the labels of a chain in order of first appearance, for comparing runs whose restarts may find the same
+//clusters in a different order (restarts tied on the objective up to round-off)
+ChainRun relabelled(ChainRun run){
+	map<int, int> ids;
+	for (int t = 0; t < run.lbls.size(); t++){
+		for (int i = 0; i < run.lbls[t].size(); i++){
+			if (ids.find(run.lbls[t][i]) == ids.end()){
+				const int id = ids.size();
+				ids[run.lbls[t][i]] = id;
+			}
+			run.lbls[t][i] = ids[run.lbls[t][i]];
+		}
+	}
+	return run;
+}
+
+//same labels, and objectives within a relative tol
+void check(const string& name, const ChainRun& ref, const ChainRun& run, double tol = 1.0e-9){
+	bool ok = (ref.objs.size() == run.objs.size());
+	for (int t = 0; ok && t < ref.objs.size(); t++){
+		ok = (ref.lbls[t] == run.lbls[t] && fabs(ref.objs[t] - run.objs[t]) <= tol*max(1.0, fabs(ref.objs[t])));
+		if (!ok){
+			cout << "  step " << t << ": objective " << run.objs[t] << " vs " << ref.objs[t] << endl;
+		}
+	}
+	cout << (ok ? "PASS " : "FAIL ") << name << endl;
+	nFailed += !ok;
+}
+
+//the old clusters of a chain by label, carried from step to step the way DynMeans does
+struct OldCluster{ V2d prm; double weight; int age; };
+typedef map<int, OldCluster> OldClusters;
+
+//the chain update, given each label's (sum, count) and optimal parameter in the step: instantiated clusters move and
+//restart their age, every cluster ages, and those that could no longer be revived for less than lambda are forgotten
+void advanceChain(OldClusters& old, const map<int, pair<V2d, double> >& stats, map<int, V2d>& prms){
+	for (map<int, pair<V2d, double> >::const_iterator it = stats.begin(); it != stats.end(); it++){
+		if (old.find(it->first) == old.end()){
+			OldCluster o = {prms[it->first], it->second.second, 0};
+			old[it->first] = o;
+		} else {
+			OldCluster& o = old[it->first];
+			o.weight = 1.0/(1.0/o.weight + o.age*tau) + it->second.second;
+			o.prm = prms[it->first];
+			o.age = 0;
+		}
+	}
+	for (OldClusters::iterator it = old.begin(); it != old.end(); ){
+		it->second.age++;
+		if (it->second.age*Q > lambda){
+			old.erase(it++);
+		} else {
+			it++;
+		}
+	}
+}
+
+//the (sum, count) and optimal parameter of each label of a step, given the old clusters; returns the step's objective.
+//The sums are taken about each label's first observation, so they don't lose the clusters' spread far from the origin
+double stepParameters(const OldClusters& old, const vector<V2d>& obs, const vector<int>& lbls, map<int, pair<V2d, double> >& stats, map<int, V2d>& prms){
+	map<int, V2d> firsts;
+	for (int i = 0; i < obs.size(); i++){
+		const V2d& first = firsts.insert(make_pair(lbls[i], obs[i])).first->second;
+		pair<V2d, double>& st = stats.insert(make_pair(lbls[i], make_pair(V2d::Zero().eval(), 0.0))).first->second;
+		st.first += obs[i] - first;
+		st.second += 1;
+	}
+	double obj = 0;
+	for (map<int, pair<V2d, double> >::iterator it = stats.begin(); it != stats.end(); it++){
+		const V2d& first = firsts[it->first];
+		const V2d& sum = it->second.first;
+		const double n = it->second.second;
+		OldClusters::const_iterator o = old.find(it->first);
+		if (o != old.end()){
+			const double gamma = 1.0/(1.0/o->second.weight + o->second.age*tau);
+			prms[it->first] = first + (gamma*(o->second.prm - first) + sum)/(gamma + n);
+			obj += Q*o->second.age + gamma*(prms[it->first] - o->second.prm).squaredNorm();
+		} else {
+			prms[it->first] = first + sum/n;
+			obj += lambda;
+		}
+	}
+	for (int i = 0; i < obs.size(); i++){
+		obj += (obs[i] - prms[lbls[i]]).squaredNorm();
+	}
+	return obj;
+}
+
+//recomputes the objective of every step from its labels alone, carrying the old clusters (parameter, weight, age) the
+//way the chain does: a new label costs lambda, a revived one Q*age plus its lag cost, and each cluster its scatter about
+//the optimal parameter. Checks that the reported objectives are those of the reported labels (up to objectiveTol); with
+//cheapest set, also that each observation's label is its cheapest choice given the step's parameters, i.e. that the
+//labels are a fixed point of the sequential step
+void checkObjectives(const string& name, const vector<vector<V2d> >& steps, const ChainRun& run, bool cheapest = false){
+	OldClusters old;
+	bool ok = (run.objs.size() == steps.size());
+	for (int t = 0; ok && t < steps.size(); t++){
+		map<int, pair<V2d, double> > stats;
+		map<int, V2d> prms;
+		const double obj = stepParameters(old, steps[t], run.lbls[t], stats, prms);
+		ok = fabs(obj - run.objs[t]) <= objectiveTol*max(1.0, obj);
+		if (!ok){
+			cout << "  step " << t << ": objective " << run.objs[t] << " vs " << obj << " from the labels" << endl;
+		}
+		for (int i = 0; ok && cheapest && i < steps[t].size(); i++){
+			//a new cluster, an instantiated one, or reviving an old one that isn't
+			double cost = lambda;
+			for (map<int, V2d>::iterator it = prms.begin(); it != prms.end(); it++){
+				cost = min(cost, (steps[t][i] - it->second).squaredNorm());
+			}
+			for (OldClusters::iterator it = old.begin(); it != old.end(); it++){
+				if (prms.find(it->first) == prms.end()){
+					const double gamma = 1.0/(1.0/it->second.weight + it->second.age*tau);
+					cost = min(cost, gamma/(gamma+1.0)*(steps[t][i] - it->second.prm).squaredNorm() + Q*it->second.age);
+				}
+			}
+			const double own = (steps[t][i] - prms[run.lbls[t][i]]).squaredNorm();
+			ok = (own <= cost + 1.0e-9*max(1.0, cost));
+			if (!ok){
+				cout << "  step " << t << ": observation " << i << " costs " << own << " in its cluster, " << cost << " elsewhere" << endl;
+			}
+		}
+		advanceChain(old, stats, prms);
+	}
+	cout << (ok ? "PASS " : "FAIL ") << name << endl;
+	nFailed += !ok;
+}
+
+void noSetup(DM& dynm){}
+
+void clusterVector(DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+	double tTaken;
+	dynm.cluster(obs, nRestarts, lbls, prms, obj, tTaken);
+}
+
+//the window as rows of a buffer with one scalar of padding, so the stride is exercised
+vector<double> stridedBuffer(const vector<V2d>& obs){
+	vector<double> data;
+	for (int i = 0; i < obs.size(); i++){
+		data.push_back(obs[i](0));
+		data.push_back(obs[i](1));
+		data.push_back(0.0);
+	}
+	return data;
+}
+
+void clusterPointer(DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+	const vector<double> data = stridedBuffer(obs);
+	double tTaken;
+	dynm.cluster(&data[0], obs.size(), 2, 3, nRestarts, lbls, prms, obj, tTaken);
+}
+
+void clusterMap(DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+	const vector<double> data = stridedBuffer(obs);
+	double tTaken;
+	dynm.cluster(DM::RowMajorObsMap(&data[0], obs.size(), 2, Eigen::OuterStride<>(3)), nRestarts, lbls, prms, obj, tTaken);
+}
+
+void clusterSparse(DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+	DM::SparseObsMatrix sp(obs.size(), 2);
+	vector<Eigen::Triplet<double> > nz;
+	for (int i = 0; i < obs.size(); i++){
+		for (int d = 0; d < 2; d++){
+			if (obs[i](d) != 0){
+				nz.push_back(Eigen::Triplet<double>(i, d, obs[i](d)));
+			}
+		}
+	}
+	sp.setFromTriplets(nz.begin(), nz.end());
+	double tTaken;
+	dynm.cluster(sp, nRestarts, lbls, prms, obj, tTaken);
+}
+
+//the same chain with a dynamic-size Vec, whose windows get packed
+ChainRun runDynamicSize(const vector<vector<V2d> >& steps){
+	DynMeans<Eigen::VectorXd> dynm(lambda, Q, tau, false, seed);
+	ChainRun run;
+	for (int t = 0; t < steps.size(); t++){
+		vector<Eigen::VectorXd> obs(steps[t].begin(), steps[t].end());
+		vector<int> lbls;
+		vector<Eigen::VectorXd> prms;
+		double obj, tTaken;
+		dynm.cluster(obs, nRestarts, lbls, prms, obj, tTaken);
+		run.lbls.push_back(lbls);
+		run.objs.push_back(obj);
+	}
+	return run;
+}
+
+//clusters the window from a file in chunks of chunkObs observations
+ClusterFn clusterFromFile(int chunkObs){
+	return [chunkObs](DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+		const char* path = "testdm_window.bin";
+		ofstream out(path, ios::binary);
+		for (int i = 0; i < obs.size(); i++){
+			out.write(reinterpret_cast<const char*>(obs[i].data()), 2*sizeof(double));
+		}
+		out.close();
+		double tTaken;
+		dynm.clusterFile(path, 2, nRestarts, lbls, prms, obj, tTaken, chunkObs);
+		remove(path);
+	};
+}
+
+//observation i counts as 1, 1.5 or 2 copies of itself
+vector<double> testWeights(int nObs){
+	vector<double> wts;
+	for (int i = 0; i < nObs; i++){
+		wts.push_back(1.0 + 0.5*(i%3));
+	}
+	return wts;
+}
+
+void clusterUnitWeights(DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+	double tTaken;
+	dynm.cluster(obs, vector<double>(obs.size(), 1.0), nRestarts, lbls, prms, obj, tTaken);
+}
+
+void clusterWeighted(DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+	double tTaken;
+	dynm.cluster(obs, testWeights(obs.size()), nRestarts, lbls, prms, obj, tTaken);
+}
+
+//int8 codes on a grid of quantScale, and the values they decode to
+const float quantScale = 0.01f;
+int8_t quantize(double x){
+	return (int8_t)max(-127.0, min(127.0, round(x/quantScale)));
+}
+
+double dequantize(double x){
+	return (double)quantScale*quantize(x);
+}
+
+//the chain moved onto the grid of the codes, so that dense and quantized windows hold the same points
+vector<vector<V2d> > gridSteps(const vector<vector<V2d> >& steps){
+	vector<vector<V2d> > grid(steps);
+	for (int t = 0; t < grid.size(); t++){
+		for (int i = 0; i < grid[t].size(); i++){
+			grid[t][i] = V2d(dequantize(grid[t][i](0)), dequantize(grid[t][i](1)));
+		}
+	}
+	return grid;
+}
+
+void clusterQuantized(DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+	vector<int8_t> codes;
+	vector<float> scales(obs.size(), quantScale);
+	for (int i = 0; i < obs.size(); i++){
+		codes.push_back(quantize(obs[i](0)));
+		codes.push_back(quantize(obs[i](1)));
+	}
+	double tTaken;
+	dynm.cluster(&codes[0], &scales[0], obs.size(), 2, 0, nRestarts, lbls, prms, obj, tTaken);
+}
+
+//the same chain embedded in 32 dimensions (the extra coordinates are small noise), with the given assignment type,
+//number of restarts and threads. With grid set the noise is moved onto the grid of the codes too, and with codes set
+//(for a chain on the grid) the windows are passed as int8 codes; with weighted set they get the weights of testWeights
+ChainRun runWide(const vector<vector<V2d> >& steps, DynMeans<Eigen::VectorXd>::AssignmentType type, int restarts, int nThreads,
+		bool grid = false, bool codes = false, bool weighted = false){
+	DynMeans<Eigen::VectorXd> dynm(lambda, Q, tau, false, seed);
+	dynm.setAssignmentType(type);
+	dynm.setNumThreads(nThreads);
+	mt19937 rng(5489u);
+	normal_distribution<double> nrm(0, 0.005);
+	ChainRun run;
+	for (int t = 0; t < steps.size(); t++){
+		vector<Eigen::VectorXd> obs;
+		for (int i = 0; i < steps[t].size(); i++){
+			Eigen::VectorXd x(32);
+			x.head(2) = steps[t][i];
+			for (int d = 2; d < 32; d++){
+				x(d) = (grid ? dequantize(nrm(rng)) : nrm(rng));
+			}
+			obs.push_back(x);
+		}
+		vector<int> lbls;
+		vector<Eigen::VectorXd> prms;
+		double obj, tTaken;
+		if (codes){
+			vector<int8_t> q;
+			for (int i = 0; i < obs.size(); i++){
+				for (int d = 0; d < 32; d++){
+					q.push_back(quantize(obs[i](d)));
+				}
+			}
+			vector<float> scales(obs.size(), quantScale);
+			dynm.cluster(&q[0], &scales[0], obs.size(), 32, 0, restarts, lbls, prms, obj, tTaken);
+		} else if (weighted){
+			dynm.cluster(obs, testWeights(obs.size()), restarts, lbls, prms, obj, tTaken);
+		} else {
+			dynm.cluster(obs, restarts, lbls, prms, obj, tTaken);
+		}
+		run.lbls.push_back(lbls);
+		run.objs.push_back(obj);
+	}
+	return run;
+}
+
+//the same chain in single precision, with the given assignment type
+ChainRun runFloat(const vector<vector<V2d> >& steps, DynMeans<Eigen::Vector2f>::AssignmentType type){
+	DynMeans<Eigen::Vector2f> dynm(lambda, Q, tau, false, seed);
+	dynm.setAssignmentType(type);
+	ChainRun run;
+	for (int t = 0; t < steps.size(); t++){
+		vector<Eigen::Vector2f> obs;
+		for (int i = 0; i < steps[t].size(); i++){
+			obs.push_back(steps[t][i].cast<float>());
+		}
+		vector<int> lbls;
+		vector<Eigen::Vector2f> prms;
+		double obj, tTaken;
+		dynm.cluster(obs, nRestarts, lbls, prms, obj, tTaken);
+		run.lbls.push_back(lbls);
+		run.objs.push_back(obj);
+	}
+	return run;
+}
+
+//streams the window in micro-batches of batchSize observations (0 = the whole window at once), then commits it
+ClusterFn clusterStream(int batchSize){
+	return [batchSize](DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+		const int n = (batchSize > 0 ? batchSize : obs.size());
+		lbls.clear();
+		for (int i = 0; i < obs.size(); i += n){
+			vector<V2d> batch(obs.begin() + i, obs.begin() + min(i + n, (int)obs.size()));
+			vector<int> batchLbls;
+			dynm.clusterBatch(batch, batchLbls);
+			lbls.insert(lbls.end(), batchLbls.begin(), batchLbls.end());
+		}
+		dynm.commitWindow(prms, obj);
+	};
+}
+
+//how many labels of the window streamed after nEmpty empty commits revive a cluster of the first window; the clusters
+//of the first window age by a step per commit, so they are forgotten once (nEmpty+1)*Q > lambda
+int revivedAfterEmptyWindows(const vector<V2d>& obs, int nEmpty){
+	DM dynm(lambda, Q, tau, false, seed);
+	vector<int> first, lbls;
+	vector<V2d> prms;
+	double obj;
+	clusterStream(0)(dynm, obs, first, prms, obj);
+	for (int i = 0; i < nEmpty; i++){
+		dynm.commitWindow(prms, obj);
+	}
+	clusterStream(0)(dynm, obs, lbls, prms, obj);
+	int nRevived = 0;
+	for (int i = 0; i < lbls.size(); i++){
+		nRevived += (find(first.begin(), first.end(), lbls[i]) != first.end());
+	}
+	return nRevived;
+}
+
+//streaming labels each observation once, so it has its own labels rather than cluster()'s
+void checkStreaming(const vector<vector<V2d> >& steps){
+	const ChainRun run = runChain(steps, noSetup, clusterStream(0));
+	checkObjectives("streaming: objectives match the labels", steps, run);
+	check("streaming: batches of 7 vs the whole window", run, runChain(steps, noSetup, clusterStream(7)));
+	const int nLive = (int)(lambda/Q) - 1;
+	const bool ok = (revivedAfterEmptyWindows(steps[0], nLive) > 0 && revivedAfterEmptyWindows(steps[0], nLive + 1) == 0);
+	cout << (ok ? "PASS " : "FAIL ") << "streaming: empty windows age the clusters" << endl;
+	nFailed += !ok;
+}
+
+//sliding windows of two steps each: window t is steps t-1 and t, so each slide expires one step and adds one
+vector<vector<V2d> > slidingWindows(const vector<vector<V2d> >& steps){
+	vector<vector<V2d> > windows;
+	for (int t = 0; t < steps.size(); t++){
+		vector<V2d> window(t > 0 ? steps[t-1] : vector<V2d>());
+		window.insert(window.end(), steps[t].begin(), steps[t].end());
+		windows.push_back(window);
+	}
+	return windows;
+}
+
+//slide() carries the previous step's labels and statistics into the next window instead of re-clustering it, so it has
+//its own labels; like those of cluster() on the whole window, they must be consistent with its objectives and a fixed
+//point of the sequential step (which the bounds must not have cut short). It refuses Q > lambda, where clusters with
+//observations would not outlive the step
+void checkSlide(const vector<vector<V2d> >& steps){
+	const vector<vector<V2d> > windows = slidingWindows(steps);
+	ChainRun run;
+	DM dynm(lambda, Q, tau, false, seed);
+	vector<int> prevIds;
+	for (int t = 0; t < steps.size(); t++){
+		const int nExpired = (t > 1 ? steps[t-2].size() : 0);
+		vector<int> expired(prevIds.begin(), prevIds.begin() + nExpired), ids, lbls;
+		vector<V2d> prms;
+		double obj, tTaken;
+		dynm.slide(steps[t], expired, ids, prms, obj, tTaken);
+		prevIds.erase(prevIds.begin(), prevIds.begin() + nExpired);
+		prevIds.insert(prevIds.end(), ids.begin(), ids.end());
+		for (int i = 0; i < prevIds.size(); i++){
+			lbls.push_back(dynm.getSlideLabel(prevIds[i]));
+		}
+		run.lbls.push_back(lbls);
+		run.objs.push_back(obj);
+	}
+	const ChainRun full = runChain(windows, noSetup, clusterVector);
+	checkObjectives("cluster() on the same windows: each label the cheapest choice", windows, full, true);
+	checkObjectives("slide: objectives match the labels, each the cheapest choice", windows, run, true);
+	DM fast(lambda, 2*lambda, tau, false, seed);
+	vector<int> ids;
+	vector<V2d> prms;
+	double obj, tTaken;
+	fast.slide(steps[0], vector<int>(), ids, prms, obj, tTaken);
+	cout << (ids.empty() ? "PASS " : "FAIL ") << "slide: refuses Q > lambda" << endl;
+	nFailed += !ids.empty();
+}
+
+//predict() labels a point against the model of the last step: after every step of the chain, each point of that step and
+//of the next must get the old cluster it would revive most cheaply on its own, or -1 where a new cluster costs less,
+//with the old clusters carried the way the chain does; one point at a time and in a batch. Before the first step and
+//after reset() there are no old clusters, while a copy made before the reset keeps them
+void checkPredict(const vector<vector<V2d> >& steps){
+	DM dynm(lambda, Q, tau, false, seed);
+	OldClusters old;
+	bool ok = (dynm.predict(steps[0][0]) == -1);
+	for (int t = 0; ok && t < steps.size(); t++){
+		vector<int> lbls;
+		vector<V2d> prms;
+		double obj;
+		clusterVector(dynm, steps[t], lbls, prms, obj);
+		map<int, pair<V2d, double> > stats;
+		map<int, V2d> stepPrms;
+		stepParameters(old, steps[t], lbls, stats, stepPrms);
+		advanceChain(old, stats, stepPrms);
+		vector<V2d> xs(steps[t]);
+		if (t+1 < steps.size()){
+			xs.insert(xs.end(), steps[t+1].begin(), steps[t+1].end());
+		}
+		vector<int> predicted;
+		dynm.predict(xs, predicted);
+		for (int i = 0; ok && i < xs.size(); i++){
+			double best = lambda;
+			map<int, double> costs;
+			for (OldClusters::iterator it = old.begin(); it != old.end(); it++){
+				const double gamma = 1.0/(1.0/it->second.weight + it->second.age*tau);
+				costs[it->first] = gamma/(gamma+1.0)*(xs[i] - it->second.prm).squaredNorm() + Q*it->second.age;
+				best = min(best, costs[it->first]);
+			}
+			//(up to ties)
+			const double slack = 1.0e-9*max(1.0, best);
+			const int lbl = dynm.predict(xs[i]);
+			ok = (lbl == predicted[i] && (lbl == -1 ? best >= lambda - slack : costs.count(lbl) > 0 && costs[lbl] <= best + slack));
+			if (!ok){
+				cout << "  step " << t << ": point " << i << " predicted " << lbl << " (batch " << predicted[i] << "), cheapest cost " << best << endl;
+			}
+		}
+	}
+	//a copy serves its own snapshot of the same model
+	DM copy(dynm);
+	dynm.reset();
+	ok = ok && (dynm.predict(steps[0][0]) == -1 && copy.predict(steps.back()[0]) != -1);
+	cout << (ok ? "PASS " : "FAIL ") << "predict: the cheapest old cluster of the last step" << endl;
+	nFailed += !ok;
+}
+
+//a ClusterWorkspace kept across windows (and shared by chains) must give the labels of a fresh one, and once it has seen
+//a window, clustering another window of the same size and cluster count must not allocate
+DM::ClusterWorkspace sharedWs;
+void useSharedWorkspace(DM& dynm){ dynm.setWorkspace(&sharedWs); }
+void checkWorkspace(const vector<vector<V2d> >& steps, const ChainRun& ref){
+	check("caller workspace", ref, runChain(steps, useSharedWorkspace, clusterVector));
+	check("caller workspace, BOUNDED", ref, runChain(steps, [](DM& dynm){ useSharedWorkspace(dynm); dynm.setAssignmentType(DM::BOUNDED); }, clusterVector));
+	check("caller workspace, 4 threads", ref, runChain(steps, [](DM& dynm){ useSharedWorkspace(dynm); dynm.setNumThreads(4); }, clusterVector));
+	//(each window under another assignment type, so the workspaces change modes between windows)
+	const DM::AssignmentType types[] = {DM::BOUNDED, DM::PACKED, DM::KDTREE, DM::BATCH, DM::EXHAUSTIVE};
+	int window = 0;
+	check("caller workspace, assignment type changed every window", ref, runChain(steps, useSharedWorkspace,
+				[&](DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+					dynm.setAssignmentType(types[window++ % 5]);
+					clusterVector(dynm, obs, lbls, prms, obj);
+				}));
+	DM dynm(lambda, Q, tau, false, seed);
+	DM::ClusterWorkspace cws;
+	dynm.setWorkspace(&cws);
+	vector<int> lbls;
+	vector<V2d> prms;
+	double obj, tTaken;
+	//(the same window again and again, so that the number of clusters settles)
+	size_t nAllocated = 0;
+	for (int t = 0; t < 4; t++){
+		const size_t before = nAllocs;
+		dynm.cluster(steps[0], nRestarts, lbls, prms, obj, tTaken);
+		nAllocated = nAllocs - before;
+	}
+	cout << (nAllocated == 0 ? "PASS " : "FAIL ") << "caller workspace: a repeated window allocates nothing (" << nAllocated << ")" << endl;
+	nFailed += (nAllocated != 0);
+}
+
+void useThreads(DM& dynm){ dynm.setNumThreads(4); }
+void useAllCores(DM& dynm){ dynm.setNumThreads(0); }
+void useBounded(DM& dynm){ dynm.setAssignmentType(DM::BOUNDED); }
+void usePacked(DM& dynm){ dynm.setAssignmentType(DM::PACKED); }
+void useKdTree(DM& dynm){ dynm.setAssignmentType(DM::KDTREE); }
+void useOldDistanceTable(DM& dynm){ dynm.setOldDistanceTable(true); }
+void useSeeding(DM& dynm){ dynm.setSeeding(true); }
+void useWarmStart(DM& dynm){ dynm.setWarmStart(true); }
+void useBatch(DM& dynm){ dynm.setAssignmentType(DM::BATCH); }
+void useApproximate(DM& dynm){ dynm.setAssignmentType(DM::APPROXIMATE); }
+void useWideApproximate(DM& dynm){
+	dynm.setAssignmentType(DM::APPROXIMATE);
+	dynm.setApproximateParameters(16, 200, 200);
+}
+
+//restart pruning only stops restarts headed for a clustering a lower restart already converged to, so it must give
+//the labels of the unpruned run, with and without threads, and it must actually stop some restarts on this data
+void checkRestartPruning(const vector<vector<V2d> >& steps, const ChainRun& ref){
+	int nPruned = 0;
+	ClusterFn clusterCounting = [&nPruned](DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+		clusterVector(dynm, obs, lbls, prms, obj);
+		nPruned += dynm.getPrunedRestarts();
+	};
+	check("restart pruning", ref, runChain(steps, [](DM& dynm){ dynm.setRestartPruning(true); }, clusterCounting));
+	check("restart pruning, 4 threads", ref, runChain(steps, [](DM& dynm){ dynm.setRestartPruning(true); dynm.setNumThreads(4); }, clusterVector));
+	check("restart pruning, BOUNDED", ref, runChain(steps, [](DM& dynm){ dynm.setRestartPruning(true); useBounded(dynm); }, clusterVector));
+	cout << (nPruned > 0 ? "PASS " : "FAIL ") << "restart pruning stops restarts (" << nPruned << ")" << endl;
+	nFailed += (nPruned == 0);
+}
+
+//D^2 seeding changes where the restarts start, so it has its own labels: they must be consistent with its objectives and
+//the same with threads, and over a chain a single seeded restart must do as well as nRestarts unseeded ones
+void checkSeeding(const vector<vector<V2d> >& steps, const ChainRun& ref){
+	const ChainRun run = runChain(steps, useSeeding, clusterVector);
+	checkObjectives("seeding: objectives match the labels", steps, run);
+	check("seeding, 4 threads", run, runChain(steps, [](DM& dynm){ useSeeding(dynm); useThreads(dynm); }, clusterVector));
+	ClusterFn clusterOnce = [](DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+		double tTaken;
+		dynm.cluster(obs, 1, lbls, prms, obj, tTaken);
+	};
+	const ChainRun once = runChain(steps, useSeeding, clusterOnce);
+	const double total = accumulate(once.objs.begin(), once.objs.end(), 0.0), refTotal = accumulate(ref.objs.begin(), ref.objs.end(), 0.0);
+	const bool ok = (total <= refTotal);
+	cout << (ok ? "PASS " : "FAIL ") << "seeding: one restart does as well as " << nRestarts << " unseeded (total objective "
+		<< total << " vs " << refTotal << ")" << endl;
+	nFailed += !ok;
+}
+
+//warm start replaces the first restart's start, so it has its own labels: they must be consistent with its objectives
+//and the same with threads. A window seen again must keep its clusters when a single warm restart clusters it
+void checkWarmStart(const vector<vector<V2d> >& steps){
+	const ChainRun run = runChain(steps, useWarmStart, clusterVector);
+	checkObjectives("warm start: objectives match the labels", steps, run);
+	check("warm start, 4 threads", run, runChain(steps, [](DM& dynm){ useWarmStart(dynm); useThreads(dynm); }, clusterVector));
+	DM dynm(lambda, Q, tau, false, seed);
+	useWarmStart(dynm);
+	vector<int> first, again;
+	vector<V2d> prms;
+	double obj, tTaken;
+	dynm.cluster(steps[0], 1, first, prms, obj, tTaken);
+	dynm.cluster(steps[0], 1, again, prms, obj, tTaken);
+	cout << (first == again ? "PASS " : "FAIL ") << "warm start: a repeated window keeps its clusters" << endl;
+	nFailed += (first != again);
+}
+
+//APPROXIMATE may miss the nearest parameter, so it is checked for consistency and quality rather than equality: the
+//objectives must be those of its labels, its sampled recall must be high and its objective close to EXHAUSTIVE's; with a
+//beam wider than the graph it must find the exact labels
+void checkApproximate(const vector<vector<V2d> >& steps, const ChainRun& ref){
+	vector<double> recalls;
+	ClusterFn clusterRecording = [&recalls](DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+		clusterVector(dynm, obs, lbls, prms, obj);
+		recalls.push_back(dynm.getApproximateRecall());
+	};
+	const ChainRun run = runChain(steps, useApproximate, clusterRecording);
+	checkObjectives("APPROXIMATE: objectives match the labels", steps, run);
+	bool ok = true;
+	for (int t = 0; t < steps.size(); t++){
+		if (recalls[t] < 0.9 || run.objs[t] > 1.01*ref.objs[t]){
+			cout << "  step " << t << ": recall " << recalls[t] << ", objective " << run.objs[t] << " vs " << ref.objs[t] << endl;
+			ok = false;
+		}
+	}
+	cout << (ok ? "PASS " : "FAIL ") << "APPROXIMATE: recall >= 0.9, objective within 1%" << endl;
+	nFailed += !ok;
+	check("APPROXIMATE, beam wider than the graph", ref, runChain(steps, useWideApproximate, clusterVector));
+}
+
+//BATCH moves observations Lloyd-style rather than one at a time; on these well-separated clusters it must still reach
+//EXHAUSTIVE's labels, and they must not depend on the threads (with a single restart on the 40 clusters, a window has
+//enough observations for its sweeps to be split over them). In 32 dimensions its search uses matrix products
+void checkBatch(const vector<vector<V2d> >& steps, const ChainRun& ref){
+	check("BATCH", ref, runChain(steps, useBatch, clusterVector));
+	ClusterFn clusterOnce = [](DM& dynm, const vector<V2d>& obs, vector<int>& lbls, vector<V2d>& prms, double& obj){
+		double tTaken;
+		dynm.cluster(obs, 1, lbls, prms, obj, tTaken);
+	};
+	check("BATCH, one restart, 4 threads", runChain(steps, useBatch, clusterOnce),
+			runChain(steps, [](DM& dynm){ useBatch(dynm); useThreads(dynm); }, clusterOnce));
+	typedef DynMeans<Eigen::VectorXd> WideDM;
+	check("BATCH, 32 dimensions", runWide(steps, WideDM::EXHAUSTIVE, nRestarts, 1), runWide(steps, WideDM::BATCH, nRestarts, 1));
+	check("BATCH, 32 dimensions, one restart, 4 threads", runWide(steps, WideDM::EXHAUSTIVE, 1, 1), runWide(steps, WideDM::BATCH, 1, 4));
+}
+
+ChainRun runSharded(const vector<vector<V2d> >& steps, int nShards, int& nStarted, bool unitWeights = false){
+	ShardedDynMeans<V2d> sdm(nShards, lambda, Q, tau, false, seed);
+	nStarted = sdm.getNumShards();
+	ChainRun run;
+	for (int t = 0; t < steps.size(); t++){
+		vector<int> lbls;
+		vector<V2d> prms;
+		double obj, tTaken;
+		if (unitWeights){
+			sdm.cluster(steps[t], vector<double>(steps[t].size(), 1.0), nRestarts, lbls, prms, obj, tTaken);
+		} else {
+			sdm.cluster(steps[t], nRestarts, lbls, prms, obj, tTaken);
+		}
+		run.lbls.push_back(lbls);
+		run.objs.push_back(obj);
+	}
+	return run;
+}
+
+//sharded clustering moves observations in the worker processes against the parameters of the start of each round, like
+//BATCH, so with one worker as with three every label must be the cheapest choice, and on the four well-separated
+//clusters (ref given) it must still reach EXHAUSTIVE's labels; with 40 clusters its first sweep, which takes the
+//observations in rounds, can settle in another local optimum. Unit weights go through the workers' weighted path and
+//must not change anything. It refuses the other assignment types
+void checkSharded(const vector<vector<V2d> >& steps, const ChainRun* ref){
+	for (int nShards = 1; nShards <= 3; nShards += 2){
+		int nStarted;
+		const ChainRun run = runSharded(steps, nShards, nStarted);
+		const string name = "sharded, " + to_string(nShards) + " worker" + (nShards > 1 ? "s" : "");
+		cout << (nStarted == nShards ? "PASS " : "FAIL ") << name << ": workers started" << endl;
+		nFailed += (nStarted != nShards);
+		if (ref != NULL){
+			check(name, *ref, run);
+		}
+		checkObjectives(name + ": objectives match the labels, each the cheapest choice", steps, run, true);
+		check(name + ", unit weights", run, runSharded(steps, nShards, nStarted, true));
+	}
+	ShardedDynMeans<V2d> sdm(2, lambda, Q, tau, false, seed);
+	useBatch(sdm.getModel());
+	vector<int> lbls;
+	vector<V2d> prms;
+	double obj, tTaken;
+	sdm.cluster(steps[0], nRestarts, lbls, prms, obj, tTaken);
+	cout << (lbls.empty() ? "PASS " : "FAIL ") << "sharded: refuses BATCH assignment" << endl;
+	nFailed += !lbls.empty();
+}
+
+//sum over the (weighted) points of the squared distance to their nearest parameter
+double quantizationCost(const vector<V2d>& pts, const vector<double>& wts, const vector<V2d>& prms){
+	double cost = 0;
+	for (int i = 0; i < pts.size(); i++){
+		double mind = numeric_limits<double>::max();
+		for (int j = 0; j < prms.size(); j++){
+			mind = min(mind, (pts[i] - prms[j]).squaredNorm());
+		}
+		cost += wts[i]*mind;
+	}
+	return cost;
+}
+
+//a lightweight coreset of m points approximates the quantization cost of any k parameters to within
+//eps*cost + eps/k*(cost of the window's mean); checked with eps = 0.25 for the parameters found on the whole window
+//and on the coreset
+void checkCoreset(const vector<vector<V2d> >& steps){
+	vector<V2d> window;
+	for (int t = 0; t < steps.size(); t++){
+		window.insert(window.end(), steps[t].begin(), steps[t].end());
+	}
+	vector<V2d> coreset;
+	vector<double> coreWts;
+	DM::buildCoreset(window, window.size()/4, coreset, coreWts, seed);
+	const vector<double> unit(window.size(), 1.0);
+	V2d mean = V2d::Zero();
+	for (int i = 0; i < window.size(); i++){
+		mean += window[i]/window.size();
+	}
+	const double meanCost = quantizationCost(window, unit, vector<V2d>(1, mean));
+	vector<vector<V2d> > prmSets(2);
+	vector<int> lbls;
+	double obj, tTaken;
+	DM full(lambda, Q, tau, false, seed), core(lambda, Q, tau, false, seed);
+	full.cluster(window, nRestarts, lbls, prmSets[0], obj, tTaken);
+	core.cluster(coreset, coreWts, nRestarts, lbls, prmSets[1], obj, tTaken);
+	const double eps = 0.25;
+	bool ok = (coreset.size() < window.size());
+	for (int p = 0; p < 2; p++){
+		const double cost = quantizationCost(window, unit, prmSets[p]), coreCost = quantizationCost(coreset, coreWts, prmSets[p]);
+		if (fabs(coreCost - cost) > eps*cost + eps/prmSets[p].size()*meanCost){
+			cout << "  " << prmSets[p].size() << " parameters: coreset cost " << coreCost << " vs " << cost << endl;
+			ok = false;
+		}
+	}
+	cout << (ok ? "PASS " : "FAIL ") << "coreset of " << coreset.size() << "/" << window.size() << " points within its bound" << endl;
+	nFailed += !ok;
+}
+
+//weights must act as copies of the observations: unit weights change nothing, the exact options must agree on a weighted
+//chain (BATCH in 32 dimensions too, where the penalties of the matrix product search depend on the weights), and a
+//coreset must approximate the objective of its window
+void checkWeights(const vector<vector<V2d> >& steps, const ChainRun& ref){
+	check("unit weights", ref, runChain(steps, noSetup, clusterUnitWeights));
+	const ChainRun weighted = runChain(steps, noSetup, clusterWeighted);
+	check("weighted, 4 threads", weighted, runChain(steps, useThreads, clusterWeighted));
+	check("weighted, BOUNDED", weighted, runChain(steps, useBounded, clusterWeighted));
+	check("weighted, BATCH", weighted, runChain(steps, useBatch, clusterWeighted));
+	typedef DynMeans<Eigen::VectorXd> WideDM;
+	check("weighted, BATCH, 32 dimensions", runWide(steps, WideDM::EXHAUSTIVE, nRestarts, 1, false, false, true),
+			runWide(steps, WideDM::BATCH, nRestarts, 1, false, false, true));
+	checkCoreset(steps);
+}
+
+//clusters every chain's windows with one MultiDynMeans, a step of all the chains at a time in batches of batchSize chains
+//(taken in reverse order on odd steps, so the batches change from step to step)
+vector<ChainRun> runMulti(const vector<vector<vector<V2d> > >& chains, int batchSize, int nThreads){
+	const int nChains = chains.size();
+	MultiDynMeans<V2d> mdm(nChains, lambda, Q, tau, seed);
+	mdm.setNumThreads(nThreads);
+	vector<ChainRun> runs(nChains);
+	for (int t = 0; t < chains[0].size(); t++){
+		for (int first = 0; first < nChains; first += batchSize){
+			vector<int> chainIds, offsets(1, 0);
+			vector<V2d> obs;
+			for (int b = first; b < min(first + batchSize, nChains); b++){
+				const int c = (t % 2 == 0 ? b : nChains-1 - b);
+				chainIds.push_back(c);
+				obs.insert(obs.end(), chains[c][t].begin(), chains[c][t].end());
+				offsets.push_back(obs.size());
+			}
+			vector<int> lbls;
+			vector<double> objs;
+			double tTaken;
+			mdm.cluster(chainIds, obs, offsets, nRestarts, lbls, objs, tTaken);
+			for (int b = 0; b < chainIds.size(); b++){
+				runs[chainIds[b]].lbls.push_back(vector<int>(lbls.begin() + offsets[b], lbls.begin() + offsets[b+1]));
+				runs[chainIds[b]].objs.push_back(objs[b]);
+			}
+		}
+	}
+	return runs;
+}
+
+//every chain of a MultiDynMeans must give the labels and objectives of a DynMeans with the same seed on its windows, with
+//one thread or several and however the chains are batched; and, like DynMeans, be translation invariant
+void checkMultiDynMeans(double offset){
+	cout << "MultiDynMeans, offset " << offset << endl;
+	vector<vector<vector<V2d> > > chains;
+	vector<ChainRun> refs;
+	for (int nCenters = 4; nCenters <= 16; nCenters *= 2){
+		chains.push_back(generateSteps(8, offset, nCenters));
+		refs.push_back(runChain(chains.back(), noSetup, clusterVector));
+	}
+	const int nChains = chains.size();
+	const int batchSizes[] = {nChains, 2, 1}, threads[] = {1, 4, 2};
+	for (int k = 0; k < 3; k++){
+		const vector<ChainRun> runs = runMulti(chains, batchSizes[k], threads[k]);
+		for (int c = 0; c < nChains; c++){
+			check("chain " + to_string(c) + " vs DynMeans, batches of " + to_string(batchSizes[k]) + ", " + to_string(threads[k]) + " thread"
+					+ (threads[k] > 1 ? "s" : ""), refs[c], runs[c]);
+		}
+	}
+	if (offset != 0){
+		vector<vector<vector<V2d> > > orig;
+		for (int nCenters = 4; nCenters <= 16; nCenters *= 2){
+			orig.push_back(generateSteps(8, 0, nCenters));
+		}
+		const vector<ChainRun> origRuns = runMulti(orig, nChains, 1), runs = runMulti(chains, nChains, 1);
+		for (int c = 0; c < nChains; c++){
+			check("chain " + to_string(c) + ": objective invariant under translation", relabelled(origRuns[c]), relabelled(runs[c]), 1.0e-6);
+		}
+	}
+}
+
+void checkDynMeans(double offset){
+	cout << "DynMeans, offset " << offset << endl;
+	objectiveTol = (offset == 0 ? 1.0e-9 : 1.0e-7);
+	const vector<vector<V2d> > steps = generateSteps(8, offset);
+	const ChainRun ref = runChain(steps, noSetup, clusterVector);
+	checkObjectives("objectives match the labels", steps, ref);
+	check("same seed", ref, runChain(steps, noSetup, clusterVector));
+	check("4 threads", ref, runChain(steps, useThreads, clusterVector));
+	check("one thread per core", ref, runChain(steps, useAllCores, clusterVector));
+	check("strided buffer", ref, runChain(steps, noSetup, clusterPointer));
+	check("row-major map", ref, runChain(steps, noSetup, clusterMap));
+	check("dynamic-size Vec", ref, runDynamicSize(steps));
+	check("BOUNDED", ref, runChain(steps, useBounded, clusterVector));
+	check("PACKED", ref, runChain(steps, usePacked, clusterVector));
+	check("KDTREE", ref, runChain(steps, useKdTree, clusterVector));
+	check("old distance table", ref, runChain(steps, useOldDistanceTable, clusterVector));
+	//enough parameters for the indexes to have some structure
+	const vector<vector<V2d> > manySteps = generateSteps(4, offset, 40);
+	const ChainRun manyRef = runChain(manySteps, noSetup, clusterVector);
+	check("BOUNDED, 40 clusters", manyRef, runChain(manySteps, useBounded, clusterVector));
+	check("PACKED, 40 clusters", manyRef, runChain(manySteps, usePacked, clusterVector));
+	check("KDTREE, 40 clusters", manyRef, runChain(manySteps, useKdTree, clusterVector));
+	check("old distance table, 40 clusters", manyRef, runChain(manySteps, useOldDistanceTable, clusterVector));
+	check("old distance table, 40 clusters, BOUNDED, 4 threads", manyRef, runChain(manySteps, [](DM& dynm){
+				useOldDistanceTable(dynm); useBounded(dynm); useThreads(dynm); }, clusterVector));
+	checkWorkspace(steps, ref);
+	checkWorkspace(manySteps, manyRef);
+	checkBatch(steps, ref);
+	checkBatch(manySteps, manyRef);
+	checkApproximate(manySteps, manyRef);
+	checkSharded(steps, &ref);
+	checkSharded(manySteps, NULL);
+	checkStreaming(steps);
+	checkSlide(steps);
+	checkSlide(manySteps);
+	checkPredict(steps);
+	checkPredict(manySteps);
+	//(one chunk holds the window, so the orderings are those of cluster(); with chunks of 16 they differ)
+	check("clusterFile", ref, runChain(steps, noSetup, clusterFromFile(65536)));
+	checkObjectives("clusterFile, chunks of 16: objectives match the labels", steps, runChain(steps, noSetup, clusterFromFile(16)));
+	checkWeights(steps, ref);
+	checkRestartPruning(steps, ref);
+	checkRestartPruning(manySteps, manyRef);
+	checkSeeding(steps, ref);
+	checkSeeding(manySteps, manyRef);
+	checkWarmStart(steps);
+	checkWarmStart(manySteps);
+	if (offset == 0){
+		//(sparse distances come from cached norms, ||x||^2 + ||c||^2 - 2*x.c, which cancel away from the origin)
+		check("sparse", ref, runChain(steps, noSetup, clusterSparse));
+		check("sparse, BOUNDED", ref, runChain(steps, useBounded, clusterSparse));
+		check("sparse, BATCH", ref, runChain(steps, useBatch, clusterSparse));
+		check("sparse, 40 clusters", manyRef, runChain(manySteps, noSetup, clusterSparse));
+		//(the codes decode to the grid exactly, so the reference is the dense chain on the grid)
+		const vector<vector<V2d> > grid = gridSteps(steps);
+		const ChainRun gridRef = runChain(grid, noSetup, clusterVector);
+		check("quantized", gridRef, runChain(grid, noSetup, clusterQuantized));
+		check("quantized, BOUNDED", gridRef, runChain(grid, useBounded, clusterQuantized));
+		check("quantized, BATCH", gridRef, runChain(grid, useBatch, clusterQuantized));
+		typedef DynMeans<Eigen::VectorXd> WideDM;
+		check("quantized, BATCH, 32 dimensions", runWide(grid, WideDM::EXHAUSTIVE, nRestarts, 1, true),
+				runWide(grid, WideDM::BATCH, nRestarts, 1, true, true));
+		//(single precision can't resolve the clusters 1e6 away from the origin)
+		const ChainRun floatRef = runFloat(steps, DynMeans<Eigen::Vector2f>::EXHAUSTIVE);
+		check("float Vec vs double", ref, floatRef, 1.0e-5);
+		check("float Vec, PACKED", floatRef, runFloat(steps, DynMeans<Eigen::Vector2f>::PACKED), 1.0e-5);
+		check("float Vec, BOUNDED", floatRef, runFloat(steps, DynMeans<Eigen::Vector2f>::BOUNDED), 1.0e-5);
+	}
+	if (offset != 0){
+		const ChainRun orig = runChain(generateSteps(8, 0), noSetup, clusterVector);
+		//(the coordinates themselves are only exact to about 1e-10 out there)
+		check("objective invariant under translation", relabelled(orig), relabelled(ref), 1.0e-6);
+	}
+}
+
+int main(int argc, char** argv){
+	checkDynMeans(0);
+	checkDynMeans(1e6);
+	checkMultiDynMeans(0);
+	checkMultiDynMeans(1e6);
+	cout << (nFailed == 0 ? "All checks passed" : "Some checks FAILED") << endl;
+	return nFailed;
+}
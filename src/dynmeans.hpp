@@ -2,26 +2,367 @@
 #include<vector>
 #include<iostream>
 #include<algorithm>
+#include<cmath>
+#include<numeric>
+#include<limits>
+#include<random>
+#include<thread>
+#include<atomic>
+#include<mutex>
+#include<string>
+#include<fstream>
+#include<cstdint>
 #include<boost/static_assert.hpp>
 #include<boost/function.hpp>
 #include<boost/bind.hpp>
+#include<boost/variant.hpp>
 #include<sys/time.h>
 #include <ctime>
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Sparse>
+#include "dynmeans_simd.hpp"
+#include "kdtree.hpp"
+#include "hnsw.hpp"
+#include "snapshot.hpp"
+#include "splitmix.hpp"
+#include "dynmeans_step.hpp"
 
+//Vec must be an Eigen column vector type (fixed or dynamic size) of float or double;
+//with float, observations, parameters and the distances between them are single precision (half the memory traffic),
+//while the cluster sums and the objective are always accumulated in double
 template <class Vec>
 class DynMeans{
 	public:
-		DynMeans(double lambda, double Q, double tau, bool verbose = false);
+		typedef typename Vec::Scalar Scalar;
+		typedef Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, 0, Eigen::OuterStride<> > RowMajorObsMap;
+		typedef Eigen::SparseMatrix<Scalar, Eigen::RowMajor> SparseObsMatrix;
+		//how each observation finds its nearest parameter during the assignment sweep
+		//EXHAUSTIVE: distance to every parameter
+		//BOUNDED: keeps per-point lower bounds and per-parameter drift (Elkan-style) to skip most distance evaluations;
+		//         same labels as EXHAUSTIVE. Memory: one bound per point and parameter, nObs x K doubles per restart
+		//         thread, where K (at least 16) grows by doubling past the most parameters (old and new) a restart has
+		//         had at once; e.g. 100k points with 1000 clusters take 0.8-1.6GB per thread. Use EXHAUSTIVE when
+		//         that doesn't fit
+		//PACKED: keeps a center-major copy of the parameters and computes the distances to all of them at once
+		//        with a SIMD kernel specialized on the compile-time dimension of Vec (see dynmeans_simd.hpp)
+		//KDTREE: branch-and-bound search of a k-d tree over the parameters (see kdtree.hpp); exact, and the
+		//        query cost grows roughly logarithmically with the number of parameters in low dimensions
+		//APPROXIMATE: searches a navigable small world graph over the parameters (see hnsw.hpp) for high-dimensional data
+		//             with many clusters; labels may differ from EXHAUSTIVE, but the objective still decreases monotonically
+		//             and new clusters are only created after an exact check against lambda
+		//BATCH: Lloyd-style sweeps for large windows: the nearest parameters are found in parallel against the parameters
+		//       at the start of the sweep (using the threads not taken by other restarts), then the moves are applied;
+		//       only observations that create or revive a cluster go through the sequential step. Objective stays monotone.
+		//       For dim >= 32 the parallel search uses blocked matrix products, ||x||^2 + ||c||^2 - 2*X*C^T, and then checks
+		//       the winner's distance exactly
+		enum AssignmentType{
+			EXHAUSTIVE,
+			BOUNDED,
+			PACKED,
+			KDTREE,
+			APPROXIMATE,
+			BATCH
+		};
+		//seed < 0 seeds the restart orderings with the current time
+		DynMeans(double lambda, double Q, double tau, bool verbose = false, int seed = -1);
 		~DynMeans();
-		
+
 		//initialize a new step and cluster
-		void cluster(std::vector<Vec>& newobservations, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		void cluster(const std::vector<Vec>& newobservations, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//same as above, but clusters the rows of a caller-owned row-major buffer in place (no copy is made)
+		void cluster(const RowMajorObsMap& newobservations, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//nObs observations of dimension dim, the first scalar of observation i at data[i*stride] (stride = 0 means stride = dim)
+		void cluster(const Scalar* data, int nObs, int dim, int stride, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//weighted observations: observation i counts as obsWeights[i] > 0 copies of itself (e.g. a coreset from buildCoreset)
+		//in the assignments, the parameters, the objective and the weights carried over to the next window.
+		//Supports EXHAUSTIVE, BOUNDED and BATCH assignment
+		void cluster(const std::vector<Vec>& newobservations, const std::vector<double>& obsWeights, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		void cluster(const Scalar* data, const double* obsWeights, int nObs, int dim, int stride, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//compresses a window into about m weighted observations (a lightweight coreset) for the weighted cluster() above;
+		//the objective of any set of parameters on the coreset approximates their objective on the window (see dynmeans_impl.hpp).
+		//seed < 0 seeds the sampling with the current time
+		static void buildCoreset(const std::vector<Vec>& observations, int m, std::vector<Vec>& coreset, std::vector<double>& coresetWeights, int seed = -1);
+		//sparse observations (e.g. TF-IDF vectors), one per row of a compressed row-major sparse matrix; the parameters stay
+		//dense and each distance costs O(nonzeros) using cached norms. Supports EXHAUSTIVE, BOUNDED and BATCH assignment
+		void cluster(const SparseObsMatrix& newobservations, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//same, in CSR form: the nonzeros of observation i are values[k] at coordinates colIdx[k] for rowPtr[i] <= k < rowPtr[i+1]
+		void cluster(const int* rowPtr, const int* colIdx, const Scalar* values, int nObs, int dim, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//int8 quantized observations (one byte per coordinate): observation i is scales[i]*codes[i*stride .. i*stride+dim)
+		//(stride = 0 means stride = dim). The parameters stay Scalar and are updated in double; distances use cached norms
+		//and a SIMD kernel on the codes (see dynmeans_simd.hpp). Supports EXHAUSTIVE, BOUNDED and BATCH assignment
+		void cluster(const int8_t* codes, const float* scales, int nObs, int dim, int stride, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//out-of-core clustering of a window too large for memory, stored in a file as raw row-major Scalars (dim per observation).
+		//Every sweep streams the file in chunks of chunkObs observations, reading the next chunk on a second thread while
+		//the current one is assigned, so only the labels and ordering (an int each per observation), the cluster statistics
+		//and two chunks are resident. Same assignment and objective as cluster() with EXHAUSTIVE assignment, except that the
+		//ordering visits the chunks in file order (shuffling within each). Restarts run one after another; seeding,
+		//warm start and the old distance table need random access to the window and are not used
+		void clusterFile(const std::string& path, int dim, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken, int chunkObs = 65536);
+		//streaming alternative to cluster: assign observations one micro-batch at a time as they arrive (labels are final),
+		//then call commitWindow to close the window and advance the chain (with no batch since the last commit, the window is
+		//empty: nothing is instantiated and every old cluster ages by a step)
+		void clusterBatch(const std::vector<Vec>& batch, std::vector<int>& labels);
+		void clusterBatch(const Scalar* data, int nObs, int dim, int stride, std::vector<int>& labels);
+		void commitWindow(std::vector<Vec>& finalParams, double& finalObj);
+		//sliding windows: instead of the whole window, pass what changed since the previous step. slide() drops the
+		//observations with ids in expired, adds the ones in added (their ids, reused after expiry, come back in addedIds)
+		//and clusters the resulting window as the next step of the chain, starting from the previous step's labels.
+		//Each observation keeps Hamerly-style bounds on its distance to its own parameter and to every alternative, shifted by
+		//how far the parameters have moved, so only the added observations and those whose bounds no longer prove their label
+		//are reassigned: when the window changes little, a step costs O(K*d) per reassigned observation and per new
+		//cluster rather than O(nObs*K*d). Same objective as cluster() on the window, up to local optimum differences.
+		//One restart per step, EXHAUSTIVE assignment only, and Q <= lambda (so that clusters with observations outlive the step);
+		//the chain must not be advanced by cluster(), clusterFile() or commitWindow() between slide() calls (call reset() to start over)
+		void slide(const std::vector<Vec>& added, const std::vector<int>& expired, std::vector<int>& addedIds, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		//label of window observation id after the last slide() (-1 if it isn't in the window)
+		int getSlideLabel(int id) const;
 		//reset DDP chain
 		void reset();
+		//labels x against the model of the last step: the label the next step would give it on its own, i.e. that of its
+		//nearest old parameter at the penalized distance gamma/(1+gamma)*||x - prm||^2 + age*Q, or -1 if that is above
+		//lambda (x would start a new cluster). Served from an immutable snapshot published at the end of every step
+		//(see snapshot.hpp), so any number of threads can call it, without locks, while the next window is being clustered
+		int predict(const Vec& x) const;
+		void predict(const std::vector<Vec>& xs, std::vector<int>& labels) const;
+		//number of threads used to run restarts in parallel (1 = serial, 0 = one per hardware thread)
+		void setNumThreads(int nThreads);
+		void setAssignmentType(AssignmentType type);
+		//graph parameters for APPROXIMATE assignment: links per node, beam width when building, beam width when searching
+		void setApproximateParameters(int M, int efConstruction, int efSearch);
+		//D^2 seeding: start each restart from parameters picked greedy k-means++ style instead of from the old parameters alone;
+		//candidate seeds are drawn with probability proportional to their distance to the closest seed so far (old parameters
+		//are the initial seeds) and kept if they lower the total distance by more than lambda, so one seeded restart
+		//usually does at least as well as many unseeded ones. Off by default
+		void setSeeding(bool seeded);
+		//warm start: label each observation with its nearest old parameter (if that is within lambda) before the first
+		//sweep of the first restart, instead of starting from no labels; when consecutive windows are similar it then
+		//converges in few sweeps. The other restarts start as usual (unlabelled, or seeded), so they still explore
+		//other solutions. The labels come from one distance pass per window. Off by default
+		void setWarmStart(bool warmStart);
+		//cache the penalized distances from every observation to every old parameter (nObs x #old doubles), computed once
+		//per cluster() call using the setNumThreads threads; the searches of EXHAUSTIVE and BOUNDED assignment (and the exact
+		//checks of APPROXIMATE) then look up uninstantiated old parameters in every sweep of every restart. Off by default
+		void setOldDistanceTable(bool useTable);
+		//restart pruning: stop a restart as soon as its labels reach a fixed point (a clustering that a sweep leaves
+		//unchanged) that a lower-indexed restart has already converged to. From there it could only end with those labels
+		//and the objective it has (an exact bound on where it converges), so it is dropped if that doesn't beat the lower
+		//restart, and kept without the sweep that would confirm convergence otherwise. The result is that of the unpruned run.
+		//Keeps the labels of every converged restart (nObs ints each) and costs O(nObs) per sweep. Ignored by APPROXIMATE,
+		//whose restarts search different graphs. Off by default
+		void setRestartPruning(bool prune);
+		//fraction of sampled APPROXIMATE queries in the last cluster() call that found the exact nearest parameter (-1 for other types)
+		double getApproximateRecall() const;
+		//number of restarts that restart pruning stopped in the last cluster() call
+		int getPrunedRestarts() const;
+		//the buffers cluster() works in: the restarts' workspaces (orderings, labels, parameters, counts, statistics and
+		//the assignment type's search state) and the per-worker results. Without one, each cluster() call allocates them
+		//and frees them when it returns; a workspace set with setWorkspace is kept by the caller across windows and only
+		//grows, so once it has seen a window, clustering another window of at most the same size (and number of clusters)
+		//allocates nothing. This holds for fixed size Vec with one thread, dense windows and EXHAUSTIVE, BOUNDED or BATCH
+		//assignment without the matrix product search, seeding or restart pruning (threads, dynamic size vectors and the
+		//other search structures still allocate as they go). A workspace may be shared by several DynMeans<Vec> instances
+		//used from one thread
+		class ClusterWorkspace;
+		//NULL (the default) goes back to a temporary workspace per call; cws must outlive its use by this instance
+		void setWorkspace(ClusterWorkspace* cws);
 	private:
+		//double precision counterpart of Vec, for the accumulated cluster sums
+		typedef Eigen::Matrix<double, Vec::RowsAtCompileTime, 1> AccumVec;
+		//the per-cluster arithmetic and slot bookkeeping shared with MultiDynMeans
+		typedef DynMeansStep<Vec> Step;
+		//The state each assignment mode keeps on top of the clusters, one struct per mode. A workspace holds only the
+		//state of the mode it is running (in Workspace::mode, started by runRestart or slide through startMode), so
+		//its buffers are reused from restart to restart while the mode stays the same, and freed when it changes.
+		//BOUNDED: bnds is nObs x bndCap (point-major), drift[j] is how far prms[j] has moved in total since the
+		//restart began, bndCtrs[j] where it was last seen
+		struct BoundedState{
+			std::vector<double> bnds, drift;
+			std::vector<Vec> bndCtrs;
+			int bndCap;
+		};
+		//PACKED: pctrs is dim x pcap (center-major, in Vec's scalar type), pscale/poffset give each parameter's
+		//penalized distance, pdists is scratch space for the kernel output
+		struct PackedState{
+			std::vector<Scalar> pctrs;
+			std::vector<double> pscale, poffset, pdists;
+			int pcap;
+		};
+		//KDTREE: the tree, the point-major parameter copy/penalties it was built from, and the parameters that changed
+		//since (stale[j] = 1 for those in dirty)
+		struct TreeState{
+			PenalizedKDTree tree;
+			std::vector<double> tpts, tscale, toffset;
+			std::vector<int> tids, dirty;
+			std::vector<char> stale;
+		};
+		//APPROXIMATE: the graph over parameter slots (dead slots are kept for navigation but flagged in graphDead),
+		//births/deaths since it was built, and recall sampling counters
+		struct GraphState{
+			HNSWGraph graph;
+			std::mt19937 graphRng;
+			std::vector<std::pair<double, int> > graphCands;
+			std::vector<char> graphDead;
+			int graphChanges;
+			long nQueries, recallHits, recallSamples;
+		};
+		//BATCH: each observation's nearest parameter/distance at the start of the sweep, which clusters were
+		//instantiated then, the observations left for the sequential step, the clusters emptied, and the threads
+		//of the sweep. For the matrix product search, the parameters (row-major, one row per slot, with spare rows),
+		//their squared norms, penalties and gammas (0 unless an uninstantiated old parameter), kept up to date one
+		//parameter at a time by paramChanged like the PACKED block
+		struct BatchState{
+			std::vector<int> bcand, bserial, bemptied;
+			std::vector<double> bdist;
+			std::vector<char> bwasInst;
+			int sweepThreads;
+			Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> gctrs;
+			std::vector<double> gnorms, gscale, goffset, ggamma;
+		};
+		//the sliding window (see slide), per observation at its last check: sup is its distance to its parameter minus
+		//that parameter's drift, slo a lower bound on the distance of any alternative (in sqrt cost units) plus sdriftTotal,
+		//smpos its position in smembers[label]. Per cluster: total drift/where it was last seen as for BOUNDED, the drift at
+		//the last sweep boundary, and the max of sup and min of slo - sup over the members (stale only in the safe direction)
+		struct SlideState{
+			std::vector<double> sup, slo, sdrift, sdriftIter, sradius, sminKey;
+			std::vector<Vec> sctrs;
+			std::vector< std::vector<int> > smembers;
+			std::vector<int> smpos;
+			double sdriftTotal;
+		};
+		//EXHAUSTIVE assignment keeps no state of its own
+		typedef boost::variant<boost::blank, BoundedState, PackedState, TreeState, GraphState, BatchState, SlideState> ModeState;
+		//working variables for a single restart; each worker thread owns one
+		struct Workspace{
+			std::vector<Vec> prms;
+			std::vector<int> cnts;
+			//total observation weight of each cluster (equal to cnts for unweighted observations)
+			std::vector<double> wts;
+			std::vector<int> lbls;
+			std::vector<int> ordering;
+			//per-cluster sufficient statistics in double, maintained incrementally by assignObservations: the sum of the
+			//cluster's observations, and the sum of their squared distances to the cluster's shift (see DynMeansStep)
+			std::vector<AccumVec> sums, shifts;
+			std::vector<double> sumsqs;
+			//squared norms of the shifts, for updating sumsqs from the nonzeros of sparse observations
+			std::vector<double> shiftNorms;
+			//slots of new clusters that died during this restart (cnts = 0), reused before growing prms
+			std::vector<int> freeSlots;
+			//restart pruning state: the canonical labels after the last two sweeps, scratch for computing them (also used
+			//by compactSlots), and whether the restart was stopped at a lower restart's fixed point
+			std::vector<int> canon, prevCanon, slotMap;
+			bool pruned;
+			//squared norms of the parameters, kept up to date by paramChanged when the observations are sparse or quantized
+			std::vector<double> pnorms;
+			//the state of the assignment mode in use (see ModeState)
+			ModeState mode;
+		};
+		//restart pruning: the canonical labels of the fixed points that finished restarts converged to, with their
+		//restart index, objective and a hash of the labels; restarts append to it when they finish
+		struct FixedPoints{
+			std::vector<int> restarts;
+			std::vector<size_t> hashes;
+			std::vector<double> objs;
+			std::vector<std::vector<int> > lbls;
+			std::mutex mtx;
+		};
+		//distances handed to the graph; they read the parameters in place
+		struct ParamDist{
+			const std::vector<Vec>& prms;
+			ParamDist(const std::vector<Vec>& prms) : prms(prms){}
+			double operator()(int a, int b) const{ return distSq(prms[a], prms[b]); }
+		};
+		struct QueryDist{
+			const std::vector<Vec>& prms;
+			const Eigen::Map<const Vec>& x;
+			QueryDist(const std::vector<Vec>& prms, const Eigen::Map<const Vec>& x) : prms(prms), x(x){}
+			double operator()(int a) const{ return distSq(prms[a], x); }
+		};
+
 		double lambda, Q, tau;
 		bool verbose;
-		std::vector<Vec> observations;
+		int nThreads;
+		//what predict needs from the last step: the old parameters, their labels and penalties
+		struct Snapshot{
+			std::vector<Vec> prms;
+			std::vector<int> lbls;
+			std::vector<double> scale, offset;
+			double lambda;
+		};
+		RCUSnapshot<Snapshot> snapshot;
+		void publishSnapshot();
+		int predictWith(const Snapshot& snap, const Vec& x) const;
+		AssignmentType assignType;
+		int graphM, graphEfConstruction, graphEfSearch;
+		double recall;
+		bool seeded, warmStart;
+		//penalized distances from observation i to old parameter j at oldDists[i*#old + j], valid while oldDistsReady
+		bool useOldDists, oldDistsReady;
+		std::vector<double> oldDists;
+		//mean of the current window, for the BATCH matrix product search, and the squared norms of the observations: about
+		//that mean for the matrix product search, about the origin for sparse and quantized windows
+		Eigen::Matrix<Scalar, 1, Eigen::Dynamic> gemmOrigin;
+		std::vector<double> obsNorms;
+		//warm start labels for the current window (-1 = none) and their distances, filled by computeWarmLabels
+		std::vector<int> warmLbls;
+		std::vector<double> warmDists;
+		//caller-held workspace for cluster(), or NULL
+		ClusterWorkspace* cws;
+		//the sweep of a ShardedDynMeans driving this chain (see sharded_dynmeans.hpp), which runs the restarts' sweeps
+		//in its worker processes; set only for the duration of the driver's cluster() calls, and empty otherwise
+		boost::function<void(Workspace&)> shardedSweep;
+		template<class V> friend class ShardedDynMeans;
+		bool pruneRestarts;
+		int nPruned;
+		//state of the open streaming window, if any
+		Workspace stream;
+		bool streamOpen;
+		//the sliding window: its observations packed by id (ids in slideFree are free), its size and dimension, and the
+		//workspace carried from one slide() to the next; slideOpen is cleared whenever the chain advances outside slide()
+		std::vector<Scalar> slideObs;
+		std::vector<int> slideFree;
+		int slideN, slideDim;
+		Workspace slideWs;
+		bool slideOpen;
+		//the seed of the chain's random streams (see splitmix.hpp) and the number of windows clustered so far
+		uint64_t seed, nWindows;
+		//non-owning view of the observations in the current window: dense (obsData), sparse CSR (obsRowPtr/obsColIdx/obsVals)
+		//or int8 quantized (obsCodes/obsScales)
+		//obsBuffer only holds data when the input can't be viewed directly (std::vector of dynamic size Vecs)
+		enum ObsLayout{
+			DENSE_WINDOW,
+			SPARSE_WINDOW,
+			QUANTIZED_WINDOW
+		};
+		ObsLayout obsLayout;
+		const Scalar* obsData;
+		const int* obsRowPtr;
+		const int* obsColIdx;
+		const Scalar* obsVals;
+		const int8_t* obsCodes;
+		const float* obsScales;
+		//per-observation weights of the current window (NULL = all 1)
+		const double* obsWeights;
+		int nObs, obsDim, obsStride;
+		//index of the observation at obsData (nonzero while clusterFile has a chunk in view)
+		int obsOffset;
+		std::vector<Scalar> obsBuffer;
+		//dense windows only
+		Eigen::Map<const Vec> obs(int idx) const;
+		//squared distance between two vectors of the same Scalar type (computed in that type, returned as double)
+		template<class A, class B> static double distSq(const Eigen::MatrixBase<A>& a, const Eigen::MatrixBase<B>& b);
+		void setObservationView(const Scalar* data, int nObs, int dim, int stride);
+		void setSparseObservationView(const int* rowPtr, const int* colIdx, const Scalar* values, int nObs, int dim);
+		void setQuantizedObservationView(const int8_t* codes, const float* scales, int nObs, int dim, int stride);
+		bool setObservationWeights(const double* obsWeights, int nObs);
+		double obsWeight(int idx) const;
+		//observation access for all window layouts
+		double obsDistSq(const Vec& c, double cnorm, int idx) const;
+		double obsDistSq(const Workspace& ws, int j, int idx) const;
+		double paramNorm(const Vec& v) const;
+		void setToObservation(Vec& v, int idx) const;
+		void addObservation(Workspace& ws, int j, int idx, int sign) const;
+		void reviveParameter(Workspace& ws, int j, int idx) const;
+		void clusterWindow(int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
 		//during each step, constants which are information about the past steps
 		//once each step is complete, these get updated
 		int nextLbl;
@@ -31,10 +372,74 @@ class DynMeans{
 		std::vector<int> ages;
 
 		//tools to help with kmeans
-		std::vector<Vec> getObsInCluster(int idx, std::vector<int> lbls); 
-		void assignObservations(std::vector<int> assgnOrdering, std::vector<int>& lbls, std::vector<int>& cnts, std::vector<Vec>& prms);
-		double setParameters(std::vector<int>& lbls, std::vector<int>& cnts, std::vector<Vec>& prms);
-		std::vector<int> updateState(std::vector<int> lbls, std::vector<int> cnts, std::vector<Vec> prms);
+		void assignObservations(Workspace& ws) const;
+		void assignObservation(Workspace& ws, const int idx) const;
+		void moveObservation(Workspace& ws, const int idx, const int minind, const double mindistsq) const;
+		void clusterEmptied(Workspace& ws, const int j) const;
+		void assignObservationsBatch(Workspace& ws) const;
+		void nearestParameterRange(Workspace& ws, int begin, int end) const;
+		void nearestParameterGemm(Workspace& ws, int begin, int end) const;
+		bool useGemm() const;
+		void resetGemm(Workspace& ws) const;
+		void gemmParameter(Workspace& ws, int j) const;
+		void nearestParameter(const Workspace& ws, int idx, int& minind, double& mindistsq) const;
+		void nearestParameterBounded(Workspace& ws, int idx, int& minind, double& mindistsq) const;
+		//makes S the state of ws's assignment mode, keeping it if it already was
+		template<class S> static S& startMode(Workspace& ws);
+		void resetBounds(Workspace& ws) const;
+		void paramChanged(Workspace& ws, int j) const;
+		void shiftBounds(Workspace& ws, int j) const;
+		void resetPacked(Workspace& ws) const;
+		void reservePacked(Workspace& ws, int ncols) const;
+		void packParameter(Workspace& ws, int j) const;
+		void penalty(const Workspace& ws, int j, double& scale, double& offset) const;
+		void rebuildTree(Workspace& ws) const;
+		void nearestParameterTree(Workspace& ws, int idx, int& minind, double& mindistsq) const;
+		void rebuildGraph(Workspace& ws) const;
+		void updateGraph(Workspace& ws, int j) const;
+		void nearestParameterApprox(Workspace& ws, int idx, int& minind, double& mindistsq) const;
+		void clearClusters(Workspace& ws, const int dim) const;
+		void compactSlots(Workspace& ws) const;
+		void seedParameters(Workspace& ws, SplitMix64& rng) const;
+		//the key of the next window's restart streams, SplitMix64(seed, window index)'s first word
+		uint64_t nextWindowSeed();
+		void computeWarmLabels();
+		void computeOldDistances();
+		void oldDistanceRows(int begin, int end);
+		void applyLabels(Workspace& ws, const std::vector<int>& lbls) const;
+		double setParameters(Workspace& ws) const;
+		void updateParameter(Workspace& ws, int i) const;
+		double clusterCost(const Workspace& ws, int i) const;
+		void updateState(std::vector<int>& lbls, const std::vector<double>& wts, const std::vector<Vec>& prms);
+		//runs restarts pulled from nextRestart in ws until none remain, keeping the best one it saw in best
+		//fixedPoints is NULL unless restart pruning is on
+		void restartWorker(std::atomic<int>& nextRestart, const int nRestarts, const uint64_t windowSeed, FixedPoints* fixedPoints,
+				std::atomic<int>& nPruned, Workspace& ws, Workspace& best, double& bestObj, int& bestRestart, long& recallHits, long& recallSamples) const;
+		//returns the converged objective, or std::numeric_limits<double>::max() if the restart was pruned
+		double runRestart(const int restart, const int nRestarts, const uint64_t windowSeed, FixedPoints* fixedPoints, Workspace& ws) const;
+		size_t canonicalLabels(Workspace& ws) const;
+		//clusterFile counterparts of runRestart/assignObservations; ok is cleared if the file can't be read
+		double runFileRestart(std::ifstream& in, const int restart, const uint64_t windowSeed, const int chunkObs, std::vector<Scalar>* bufs, Workspace& ws, bool& ok);
+		bool sweepFile(std::ifstream& in, const int chunkObs, std::vector<Scalar>* bufs, Workspace& ws);
+		//slide() helpers: reassign one observation and refresh its bounds, record a parameter move, close a sweep,
+		//collect the observations whose bounds fail, tighten the bounds near a parameter that got cheaper, and renumber the clusters
+		void slideCheck(Workspace& ws, const int idx) const;
+		void slideMoved(Workspace& ws, const int j) const;
+		void slideBoundary(Workspace& ws) const;
+		void slideCollect(Workspace& ws, std::vector<int>& todo) const;
+		void slideAppeared(Workspace& ws, const int u) const;
+		void slideRemap(Workspace& ws, const std::vector<int>& newIdx, const int newK) const;
+};
+
+template <class Vec>
+class DynMeans<Vec>::ClusterWorkspace{
+	private:
+		friend class DynMeans<Vec>;
+		//one workspace per worker thread for the restart being run, and one for the best restart it has seen
+		std::vector<Workspace> workers, bests;
+		std::vector<double> bestObjs;
+		std::vector<int> bestRestarts;
+		std::vector<long> recallHits, recallSamples;
 };
 #include "dynmeans_impl.hpp"
 #define __DYNMEANS_HPP
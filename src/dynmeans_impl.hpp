@@ -1,16 +1,42 @@
 #ifndef __DYNMEANS_IMPL_HPP
 template<class Vec>
-DynMeans<Vec>::DynMeans(double lambda, double Q, double tau, bool verbose){
+DynMeans<Vec>::DynMeans(double lambda, double Q, double tau, bool verbose, int seed){
 	this->verbose = verbose;
 	this->lambda = lambda;
 	this->Q = Q;
 	this->tau = tau;
+	this->nThreads = 1;
+	this->assignType = EXHAUSTIVE;
+	this->graphM = 16;
+	this->graphEfConstruction = 64;
+	this->graphEfSearch = 32;
+	this->recall = -1;
+	this->seeded = false;
+	this->warmStart = false;
+	this->useOldDists = this->oldDistsReady = false;
+	this->pruneRestarts = false;
+	this->nPruned = 0;
+	this->streamOpen = false;
+	this->slideOpen = false;
+	this->slideN = this->slideDim = 0;
+	this->cws = NULL;
 	this->ages.clear();
 	this->oldprms.clear();
 	this->oldprmlbls.clear();
-	this->observations.clear();
+	this->obsLayout = DENSE_WINDOW;
+	this->obsData = NULL;
+	this->obsOffset = 0;
+	this->obsRowPtr = this->obsColIdx = NULL;
+	this->obsVals = NULL;
+	this->obsCodes = NULL;
+	this->obsScales = NULL;
+	this->obsWeights = NULL;
+	this->nObs = this->obsDim = this->obsStride = 0;
 	this->weights.clear();
 	this->nextLbl = 0;
+	//seed the random streams with time now (seed < 0) or seed (seed >= 0)
+	this->seed = (seed < 0 ? (uint64_t)std::time(0) : (uint64_t)seed);
+	this->nWindows = 0;
 }
 
 template<class Vec>
@@ -22,54 +48,266 @@ void DynMeans<Vec>::reset(){
 	this->ages.clear();
 	this->oldprms.clear();
 	this->oldprmlbls.clear();
-	this->observations.clear();
+	this->obsLayout = DENSE_WINDOW;
+	this->obsData = NULL;
+	this->obsOffset = 0;
+	this->obsRowPtr = this->obsColIdx = NULL;
+	this->obsVals = NULL;
+	this->obsCodes = NULL;
+	this->obsScales = NULL;
+	this->obsWeights = NULL;
+	this->nObs = this->obsDim = this->obsStride = 0;
+	this->obsBuffer.clear();
 	this->weights.clear();
 	this->nextLbl = 0;
+	this->streamOpen = false;
+	this->slideOpen = false;
+	this->slideObs.clear();
+	this->slideFree.clear();
+	this->slideN = this->slideDim = 0;
+	this->publishSnapshot();
 }
 
-//This function is used when sampling parameters - it returns a vector of the observations in the next cluster,
-//along with the index of that cluster.
-//If this is the last parameter to be sampled, the function returns true; otherwise, false.
 template<class Vec>
-std::vector<Vec> DynMeans<Vec>::getObsInCluster(int idx, std::vector<int> lbls){
-	//std::cout << "Getting obs set in next cluster" << std::endl;
-	std::vector<Vec> obsInCluster;
-	obsInCluster.reserve(lbls.size());
-	//std::cout << "Getting obs for param with idx " << idx << std::endl;
-	for (int i = 0; i < lbls.size(); i++){
-		if (lbls[i] == idx){
-			obsInCluster.push_back(this->observations[i]);
+void DynMeans<Vec>::setNumThreads(int nThreads){
+	if (nThreads < 0){
+		std::cout << "libdynmeans: ERROR: Cannot have nThreads < 0" << std::endl;
+		return;
+	}
+	if (nThreads == 0){
+		nThreads = std::thread::hardware_concurrency();
+	}
+	this->nThreads = std::max(nThreads, 1);
+}
+
+template<class Vec>
+void DynMeans<Vec>::setWorkspace(ClusterWorkspace* cws){
+	this->cws = cws;
+}
+
+template<class Vec>
+void DynMeans<Vec>::setAssignmentType(AssignmentType type){
+	this->assignType = type;
+}
+
+template<class Vec>
+void DynMeans<Vec>::setApproximateParameters(int M, int efConstruction, int efSearch){
+	if (M < 2 || efConstruction < 1 || efSearch < 1){
+		std::cout << "libdynmeans: ERROR: Cannot have M < 2, efConstruction < 1 or efSearch < 1" << std::endl;
+		return;
+	}
+	this->graphM = M;
+	this->graphEfConstruction = efConstruction;
+	this->graphEfSearch = efSearch;
+}
+
+template<class Vec>
+void DynMeans<Vec>::setSeeding(bool seeded){
+	this->seeded = seeded;
+}
+
+template<class Vec>
+void DynMeans<Vec>::setWarmStart(bool warmStart){
+	this->warmStart = warmStart;
+}
+
+template<class Vec>
+void DynMeans<Vec>::setOldDistanceTable(bool useTable){
+	this->useOldDists = useTable;
+}
+
+template<class Vec>
+void DynMeans<Vec>::setRestartPruning(bool prune){
+	this->pruneRestarts = prune;
+}
+
+template<class Vec>
+double DynMeans<Vec>::getApproximateRecall() const{
+	return this->recall;
+}
+
+template<class Vec>
+int DynMeans<Vec>::getPrunedRestarts() const{
+	return this->nPruned;
+}
+
+template<class Vec>
+Eigen::Map<const Vec> DynMeans<Vec>::obs(int idx) const{
+	return Eigen::Map<const Vec>(this->obsData + (size_t)(idx - this->obsOffset)*this->obsStride, this->obsDim);
+}
+
+template<class Vec>
+template<class A, class B>
+double DynMeans<Vec>::distSq(const Eigen::MatrixBase<A>& a, const Eigen::MatrixBase<B>& b){
+	return (a - b).squaredNorm();
+}
+
+template<class Vec>
+void DynMeans<Vec>::setObservationView(const Scalar* data, int nObs, int dim, int stride){
+	this->obsLayout = DENSE_WINDOW;
+	this->obsData = data;
+	this->obsOffset = 0;
+	this->nObs = nObs;
+	this->obsDim = dim;
+	this->obsStride = (stride == 0 ? dim : stride);
+}
+
+template<class Vec>
+void DynMeans<Vec>::setSparseObservationView(const int* rowPtr, const int* colIdx, const Scalar* values, int nObs, int dim){
+	this->obsLayout = SPARSE_WINDOW;
+	this->obsRowPtr = rowPtr;
+	this->obsColIdx = colIdx;
+	this->obsVals = values;
+	this->nObs = nObs;
+	this->obsDim = dim;
+	this->obsStride = 0;
+}
+
+template<class Vec>
+void DynMeans<Vec>::setQuantizedObservationView(const int8_t* codes, const float* scales, int nObs, int dim, int stride){
+	this->obsLayout = QUANTIZED_WINDOW;
+	this->obsCodes = codes;
+	this->obsScales = scales;
+	this->nObs = nObs;
+	this->obsDim = dim;
+	this->obsStride = (stride == 0 ? dim : stride);
+}
+
+//squared distance from observation idx to the dense vector c. For sparse and quantized observations it is
+//||x||^2 + ||c||^2 - 2*x.c, which costs O(nonzeros of x) or one pass over the int8 codes given cnorm = ||c||^2 (see paramNorm);
+//dense observations ignore cnorm
+template<class Vec>
+double DynMeans<Vec>::obsDistSq(const Vec& c, double cnorm, int idx) const{
+	double dot = 0;
+	if (this->obsLayout == DENSE_WINDOW){
+		return distSq(c, this->obs(idx));
+	} else if (this->obsLayout == SPARSE_WINDOW){
+		for (int k = this->obsRowPtr[idx]; k < this->obsRowPtr[idx+1]; k++){
+			dot += (double)this->obsVals[k]*(double)c(this->obsColIdx[k]);
+		}
+	} else {
+		dot = this->obsScales[idx]*quantizedDot(this->obsCodes + (size_t)idx*this->obsStride, c.data(), this->obsDim);
+	}
+	return std::max(this->obsNorms[idx] + cnorm - 2.0*dot, 0.0);
+}
+
+//same, to parameter j (whose norm is kept in ws.pnorms for sparse and quantized observations)
+template<class Vec>
+double DynMeans<Vec>::obsDistSq(const Workspace& ws, int j, int idx) const{
+	return this->obsDistSq(ws.prms[j], (this->obsLayout == DENSE_WINDOW ? 0.0 : ws.pnorms[j]), idx);
+}
+
+//the cnorm argument of obsDistSq for vector v: ||v||^2, or unused (0) for dense observations
+template<class Vec>
+double DynMeans<Vec>::paramNorm(const Vec& v) const{
+	return (this->obsLayout == DENSE_WINDOW ? 0.0 : v.template cast<double>().squaredNorm());
+}
+
+//observation idx counts as obsWeight(idx) copies of itself
+template<class Vec>
+double DynMeans<Vec>::obsWeight(int idx) const{
+	return (this->obsWeights == NULL ? 1.0 : this->obsWeights[idx]);
+}
+
+//sets v to (a dense copy of) observation idx
+template<class Vec>
+void DynMeans<Vec>::setToObservation(Vec& v, int idx) const{
+	if (this->obsLayout == DENSE_WINDOW){
+		v = this->obs(idx);
+	} else if (this->obsLayout == SPARSE_WINDOW){
+		v.setZero(this->obsDim);
+		for (int k = this->obsRowPtr[idx]; k < this->obsRowPtr[idx+1]; k++){
+			v(this->obsColIdx[k]) = this->obsVals[k];
+		}
+	} else {
+		const int8_t* q = this->obsCodes + (size_t)idx*this->obsStride;
+		const double scale = this->obsScales[idx];
+		v.resize(this->obsDim);
+		for (int d = 0; d < this->obsDim; d++){
+			v(d) = (Scalar)(scale*q[d]);
+		}
+	}
+}
+
+//adds observation idx (with its weight) to (sign = 1) or removes it from (sign = -1) the sufficient statistics of cluster j
+template<class Vec>
+void DynMeans<Vec>::addObservation(Workspace& ws, int j, int idx, int sign) const{
+	const double w = sign*this->obsWeight(idx);
+	if (this->obsLayout == DENSE_WINDOW){
+		Step::addPoint(ws, j, this->obs(idx).template cast<double>(), w);
+		return;
+	}
+	ws.wts[j] += w;
+	const AccumVec& shift = ws.shifts[j];
+	double distsq = 0;
+	if (this->obsLayout == SPARSE_WINDOW){
+		//||x - shift||^2 = ||shift||^2 + sum over the nonzeros of x_k*(x_k - 2*shift_k), so the update stays O(nnz)
+		distsq = ws.shiftNorms[j];
+		for (int k = this->obsRowPtr[idx]; k < this->obsRowPtr[idx+1]; k++){
+			const double x = this->obsVals[k];
+			ws.sums[j](this->obsColIdx[k]) += w*x;
+			distsq += x*(x - 2.0*shift(this->obsColIdx[k]));
+		}
+		distsq = std::max(distsq, 0.0);
+	} else {
+		const int8_t* q = this->obsCodes + (size_t)idx*this->obsStride;
+		const double scale = (double)this->obsScales[idx];
+		for (int d = 0; d < this->obsDim; d++){
+			const double x = scale*q[d];
+			ws.sums[j](d) += w*x;
+			distsq += (x - shift(d))*(x - shift(d));
+		}
+	}
+	ws.sumsqs[j] += w*distsq;
+}
+
+//moves old parameter j from oldprms[j] to its optimum given observation idx alone, when idx instantiates it
+template<class Vec>
+void DynMeans<Vec>::reviveParameter(Workspace& ws, int j, int idx) const{
+	double gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+	const double w = this->obsWeight(idx);
+	if (this->obsLayout == DENSE_WINDOW){
+		ws.prms[j] = ((this->oldprms[j].template cast<double>()*gamma + w*this->obs(idx).template cast<double>())/(gamma + w)).template cast<Scalar>();
+		return;
+	}
+	AccumVec blend = this->oldprms[j].template cast<double>()*gamma;
+	if (this->obsLayout == SPARSE_WINDOW){
+		for (int k = this->obsRowPtr[idx]; k < this->obsRowPtr[idx+1]; k++){
+			blend(this->obsColIdx[k]) += w*(double)this->obsVals[k];
+		}
+	} else {
+		const int8_t* q = this->obsCodes + (size_t)idx*this->obsStride;
+		const double scale = w*(double)this->obsScales[idx];
+		for (int d = 0; d < this->obsDim; d++){
+			blend(d) += scale*q[d];
 		}
 	}
-	return obsInCluster;
+	ws.prms[j] = (blend/(gamma + w)).template cast<Scalar>();
 }
 
+//advances the chain to the parameters prms of the step just clustered, with total observation weights wts;
+//lbls holds the window's labels as indices into prms on input, and the corresponding chain labels on output
 template<class Vec>
-std::vector<int> DynMeans<Vec>::updateState(std::vector<int> lbls, std::vector<int> cnts, std::vector<Vec> prms){
+void DynMeans<Vec>::updateState(std::vector<int>& lbls, const std::vector<double>& wts, const std::vector<Vec>& prms){
+	//the sliding window's workspace is aligned with the old parameters; slide() reopens it after its own update
+	this->slideOpen = false;
 	this->oldprms = prms;
-	std::vector<int> outLbls; //stores the label output using oldprmlbls
-	//update the weights/ages
+	//update the weights/ages (new clusters get the next labels)
 	for (int i = 0; i < prms.size(); i++){
-		if (i < this->weights.size() && cnts[i] > 0){
-			//this is an instantiated cluster from a previous time; set age to 0 and update weights
-			this->weights[i] = 1.0/(1.0/this->weights[i] + this->ages[i]*this->tau) + cnts[i];
-			this->ages[i] = 0;
-		} else if (i >= this->weights.size() ) {
-			//new cluster
-			//push back a 0 for the age, and set the weight to the number of observations
+		const bool isNew = (i >= this->weights.size());
+		if (isNew){
 			this->ages.push_back(0);
-			this->weights.push_back(cnts[i]);
+			this->weights.push_back(0.0);
 			this->oldprmlbls.push_back(this->nextLbl++);
 		}
-		//increment the age for all clusters (including old clusters with i < weights.size() && cnts = 0)
-		this->ages[i]++;
+		Step::advanceCluster(this->weights[i], this->ages[i], wts[i], this->tau, isNew);
 	}
 	for(int i = 0; i < lbls.size(); i++){
-		outLbls.push_back(this->oldprmlbls[lbls[i]]);
+		lbls[i] = this->oldprmlbls[lbls[i]];
 	}
 	//now that all is updated, check to see which clusters are permanently dead
 	for(int i = 0; i < this->oldprms.size(); i++){
-		if (this->ages[i]*this->Q > this->lambda){
+		if (Step::permanentlyDead(this->ages[i], this->Q, this->lambda)){
 			this->oldprms.erase(this->oldprms.begin()+i);
 			this->oldprmlbls.erase(this->oldprmlbls.begin()+i);
 			this->weights.erase(this->weights.begin()+i);
@@ -77,221 +315,2074 @@ std::vector<int> DynMeans<Vec>::updateState(std::vector<int> lbls, std::vector<i
 			i--;
 		}
 	}
-	return outLbls;
+	this->publishSnapshot();
 }
 
+//replaces the model served by predict with the old parameters of the step that just ended;
+//the two snapshots alternate, so steps of a steady size don't allocate
 template<class Vec>
-void DynMeans<Vec>::cluster(std::vector<Vec>& newobservations, int nRestarts, 
-		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
-	timeval tStart;
-	gettimeofday(&tStart, NULL);
+void DynMeans<Vec>::publishSnapshot(){
+	Snapshot* snap = this->snapshot.recycle();
+	if (snap == NULL){
+		snap = new Snapshot();
+	}
+	snap->prms = this->oldprms;
+	snap->lbls = this->oldprmlbls;
+	snap->scale.resize(this->oldprms.size());
+	snap->offset.resize(this->oldprms.size());
+	for (int j = 0; j < this->oldprms.size(); j++){
+		double gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+		snap->scale[j] = gamma/(1.0+gamma);
+		snap->offset[j] = this->ages[j]*this->Q;
+	}
+	snap->lambda = this->lambda;
+	this->snapshot.publishRecycling(snap);
+}
+
+template<class Vec>
+int DynMeans<Vec>::predict(const Vec& x) const{
+	typename RCUSnapshot<Snapshot>::Reader reader(this->snapshot);
+	if (reader.get() == NULL){
+		return -1;
+	}
+	return this->predictWith(*reader.get(), x);
+}
+
+template<class Vec>
+void DynMeans<Vec>::predict(const std::vector<Vec>& xs, std::vector<int>& labels) const{
+	//one snapshot for the whole batch, so all of it is labelled against the same step
+	typename RCUSnapshot<Snapshot>::Reader reader(this->snapshot);
+	labels.assign(xs.size(), -1);
+	if (reader.get() == NULL){
+		return;
+	}
+	for (int i = 0; i < xs.size(); i++){
+		labels[i] = this->predictWith(*reader.get(), xs[i]);
+	}
+}
 
+//only reads snap, never the members being updated by the clustering thread
+template<class Vec>
+int DynMeans<Vec>::predictWith(const Snapshot& snap, const Vec& x) const{
+	if (!snap.prms.empty() && x.size() != snap.prms[0].size()){
+		std::cout << "libdynmeans: ERROR: point dimension " << x.size() << " does not match the model (" << snap.prms[0].size() << ")" << std::endl;
+		return -1;
+	}
+	int minind = -1;
+	double mindistsq = snap.lambda;
+	for (int j = 0; j < snap.prms.size(); j++){
+		double tmpdistsq = snap.scale[j]*distSq(snap.prms[j], x) + snap.offset[j];
+		if (tmpdistsq <= mindistsq && (minind < 0 || tmpdistsq < mindistsq)){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+	}
+	return (minind < 0 ? -1 : snap.lbls[minind]);
+}
 
-	//set the new obs
-	this->observations = newobservations;
+template<class Vec>
+void DynMeans<Vec>::cluster(const std::vector<Vec>& newobservations, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	if (newobservations.size() == 0){
+		std::cout << "libdynmeans: ERROR: newobservations is empty" << std::endl;
+		return;
+	}
+	const int dim = newobservations[0].size();
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && sizeof(Vec) % sizeof(Scalar) == 0){
+		//fixed size vectors are stored contiguously in the std::vector, so view them in place
+		this->setObservationView(newobservations[0].data(), newobservations.size(), dim, sizeof(Vec)/sizeof(Scalar));
+	} else {
+		//dynamic size vectors each own their storage; pack them once
+		this->obsBuffer.resize((size_t)newobservations.size()*dim);
+		for (int i = 0; i < newobservations.size(); i++){
+			Eigen::Map<Vec>(&this->obsBuffer[(size_t)i*dim], dim) = newobservations[i];
+		}
+		this->setObservationView(&this->obsBuffer[0], newobservations.size(), dim, dim);
+	}
+	this->clusterWindow(nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
 
+template<class Vec>
+void DynMeans<Vec>::cluster(const std::vector<Vec>& newobservations, const std::vector<double>& obsWeights, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
 	if (newobservations.size() == 0){
 		std::cout << "libdynmeans: ERROR: newobservations is empty" << std::endl;
 		return;
 	}
-	if (nRestarts <= 0){
-		std::cout << "libdynmeans: ERROR: Cannot have nRestarts <= 0" << std::endl;
+	if (obsWeights.size() != newobservations.size()){
+		std::cout << "libdynmeans: ERROR: obsWeights must have one weight per observation" << std::endl;
+		return;
+	}
+	if (!this->setObservationWeights(&obsWeights[0], obsWeights.size())){
+		return;
+	}
+	this->cluster(newobservations, nRestarts, finalLabels, finalParams, finalObj, tTaken);
+	this->obsWeights = NULL;
+}
+
+template<class Vec>
+void DynMeans<Vec>::cluster(const Scalar* data, const double* obsWeights, int nObs, int dim, int stride, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	if (nObs <= 0 || data == NULL || obsWeights == NULL){
+		std::cout << "libdynmeans: ERROR: newobservations is empty" << std::endl;
 		return;
 	}
+	if (!this->setObservationWeights(obsWeights, nObs)){
+		return;
+	}
+	this->cluster(data, nObs, dim, stride, nRestarts, finalLabels, finalParams, finalObj, tTaken);
+	this->obsWeights = NULL;
+}
+
+//checks the weights and sets them for the next window; they are cleared when it is done
+template<class Vec>
+bool DynMeans<Vec>::setObservationWeights(const double* obsWeights, int nObs){
+	if (this->assignType == PACKED || this->assignType == KDTREE || this->assignType == APPROXIMATE){
+		std::cout << "libdynmeans: ERROR: Weighted observations only support EXHAUSTIVE, BOUNDED and BATCH assignment" << std::endl;
+		return false;
+	}
+	for (int i = 0; i < nObs; i++){
+		if (!(obsWeights[i] > 0) || !std::isfinite(obsWeights[i])){
+			std::cout << "libdynmeans: ERROR: Observation weights must be positive and finite" << std::endl;
+			return false;
+		}
+	}
+	this->obsWeights = obsWeights;
+	return true;
+}
 
-	//generate the orderings
-	std::vector< std::vector<int> > randOrderings;
-	std::vector<int> tmpindices;
-	for (int i = 0; i < newobservations.size(); i++){
-		tmpindices.push_back(i);
+//Lightweight coreset (Bachem, Lucic & Krause, 2018): draws m observations i.i.d. with probability
+//	q(x) = 1/(2n) + ||x - mean||^2/(2*sum_x' ||x' - mean||^2)
+//and gives each draw weight 1/(m*q(x)) (repeated draws are merged), in O(n*d). With m on the order of d*k*log(k)/eps^2,
+//the cost of any k parameters on the weighted coreset is, with high probability, within eps*(their cost + the cost of the
+//window's mean/k) of their cost on the whole window, so clustering the coreset with the weighted cluster() approximates
+//clustering the window. m >= n returns the window itself with unit weights
+template<class Vec>
+void DynMeans<Vec>::buildCoreset(const std::vector<Vec>& observations, int m, std::vector<Vec>& coreset, std::vector<double>& coresetWeights, int seed){
+	coreset.clear();
+	coresetWeights.clear();
+	const int n = observations.size();
+	if (n == 0 || m <= 0){
+		return;
+	}
+	if (m >= n){
+		coreset = observations;
+		coresetWeights.assign(n, 1.0);
+		return;
+	}
+	AccumVec mean = AccumVec::Zero(observations[0].size());
+	for (int i = 0; i < n; i++){
+		mean += observations[i].template cast<double>();
+	}
+	mean /= n;
+	std::vector<double> q(n);
+	double total = 0;
+	for (int i = 0; i < n; i++){
+		q[i] = (observations[i].template cast<double>() - mean).squaredNorm();
+		total += q[i];
+	}
+	for (int i = 0; i < n; i++){
+		q[i] = 0.5/n + (total > 0 ? 0.5*q[i]/total : 0.5/n);
 	}
-	std::srand( unsigned( std::time(0) ) );
-	for (int i = 0; i < nRestarts; i++){
-		//cout << "Generating random order " << i+1 << "/" << nOrderings << "               \r" << flush;
-		random_shuffle(tmpindices.begin(), tmpindices.end());
-		randOrderings.push_back(tmpindices);
+	std::mt19937 rng(seed < 0 ? (unsigned int)time(NULL) : (unsigned int)seed);
+	std::discrete_distribution<int> draw(q.begin(), q.end());
+	std::vector<int> draws(n, 0);
+	for (int t = 0; t < m; t++){
+		draws[draw(rng)]++;
 	}
+	for (int i = 0; i < n; i++){
+		if (draws[i] > 0){
+			coreset.push_back(observations[i]);
+			coresetWeights.push_back(draws[i]/(m*q[i]));
+		}
+	}
+}
 
-	//stuff for storing best clustering
-	finalObj =  std::numeric_limits<double>::max();
-	std::vector<int> finalCnts;
+template<class Vec>
+void DynMeans<Vec>::cluster(const RowMajorObsMap& newobservations, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	this->cluster(newobservations.data(), newobservations.rows(), newobservations.cols(), newobservations.outerStride(), 
+			nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
 
-	if (verbose){
-		std::cout << "libdynmeans: Clustering " << newobservations.size() << " datapoints with " << nRestarts << " restarts." << std::endl;
+template<class Vec>
+void DynMeans<Vec>::cluster(const Scalar* data, int nObs, int dim, int stride, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	if (nObs <= 0 || data == NULL){
+		std::cout << "libdynmeans: ERROR: newobservations is empty" << std::endl;
+		return;
+	}
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && dim != Vec::SizeAtCompileTime){
+		std::cout << "libdynmeans: ERROR: observation dimension " << dim << " does not match the vector type (" << Vec::SizeAtCompileTime << ")" << std::endl;
+		return;
+	}
+	if (stride != 0 && stride < dim){
+		std::cout << "libdynmeans: ERROR: Cannot have 0 < stride < dim" << std::endl;
+		return;
 	}
-	for (int i = 0; i < nRestarts; i++){
+	this->setObservationView(data, nObs, dim, stride);
+	this->clusterWindow(nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
 
-		//create working variables
-		std::vector<Vec> prms;
-		std::vector<int> cnts;
-		std::vector<int> lbls;
+template<class Vec>
+void DynMeans<Vec>::cluster(const SparseObsMatrix& newobservations, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	if (!newobservations.isCompressed()){
+		std::cout << "libdynmeans: ERROR: sparse newobservations must be compressed (call makeCompressed())" << std::endl;
+		return;
+	}
+	this->cluster(newobservations.outerIndexPtr(), newobservations.innerIndexPtr(), newobservations.valuePtr(), 
+			newobservations.rows(), newobservations.cols(), nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
 
-		for (int j = 0; j < this->oldprms.size(); j++){
-			prms.push_back(this->oldprms[j]); //just placeholders for updated parameters if the old ones get instantiated
-			cnts.push_back(0); //start with count 0
-		}
+template<class Vec>
+void DynMeans<Vec>::cluster(const int* rowPtr, const int* colIdx, const Scalar* values, int nObs, int dim, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	if (nObs <= 0 || rowPtr == NULL){
+		std::cout << "libdynmeans: ERROR: newobservations is empty" << std::endl;
+		return;
+	}
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && dim != Vec::SizeAtCompileTime){
+		std::cout << "libdynmeans: ERROR: observation dimension " << dim << " does not match the vector type (" << Vec::SizeAtCompileTime << ")" << std::endl;
+		return;
+	}
+	if (this->assignType == PACKED || this->assignType == KDTREE || this->assignType == APPROXIMATE){
+		std::cout << "libdynmeans: ERROR: Sparse observations only support EXHAUSTIVE, BOUNDED and BATCH assignment" << std::endl;
+		return;
+	}
+	this->setSparseObservationView(rowPtr, colIdx, values, nObs, dim);
+	this->clusterWindow(nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
 
-		//Initialization: no label on anything
-		for (int j = 0; j < this->observations.size(); j++){
-			lbls.push_back(-1); // start with no labels on anything
-		}
+template<class Vec>
+void DynMeans<Vec>::cluster(const int8_t* codes, const float* scales, int nObs, int dim, int stride, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	if (nObs <= 0 || codes == NULL || scales == NULL){
+		std::cout << "libdynmeans: ERROR: newobservations is empty" << std::endl;
+		return;
+	}
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && dim != Vec::SizeAtCompileTime){
+		std::cout << "libdynmeans: ERROR: observation dimension " << dim << " does not match the vector type (" << Vec::SizeAtCompileTime << ")" << std::endl;
+		return;
+	}
+	if (stride != 0 && stride < dim){
+		std::cout << "libdynmeans: ERROR: Cannot have 0 < stride < dim" << std::endl;
+		return;
+	}
+	if (this->assignType == PACKED || this->assignType == KDTREE || this->assignType == APPROXIMATE){
+		std::cout << "libdynmeans: ERROR: Quantized observations only support EXHAUSTIVE, BOUNDED and BATCH assignment" << std::endl;
+		return;
+	}
+	this->setQuantizedObservationView(codes, scales, nObs, dim, stride);
+	this->clusterWindow(nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
 
-		double obj, prevobj;
-		obj = prevobj = std::numeric_limits<double>::max();
+template<class Vec>
+void DynMeans<Vec>::clusterFile(const std::string& path, int dim, int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken, int chunkObs){
+	timeval tStart;
+	gettimeofday(&tStart, NULL);
 
-		do {
-			//do the kmeans iteration
-			prevobj = obj;
-			this->assignObservations(randOrderings[i], lbls, cnts, prms);
-			obj = this->setParameters(lbls, cnts, prms);
-			if (obj > prevobj){
-				std::cout << "Error: obj > prevobj - monotonicity violated! Check your distance/set parameter functions..." << std::endl;
-				std::cout << "obj: " << obj << " prevobj: " << prevobj << std::endl;
-			}
-			//std::cout << "KMeans -- Restart: " << i+1 << "/" << nRestarts << " Iteration: " << iter << " Objective: " << obj << std::endl;//"\r" << std::flush;
-			if (verbose){
-				int numinst = 0;
-				for (int ii = 0; ii < cnts.size(); ii++){
-					if (cnts[ii] > 0){
-						numinst++;
-					}
-				}
-				int numnew = prms.size() - this->oldprms.size();
-				int numoldinst = numinst - numnew;
-				int numolduninst = cnts.size() - numinst;
-			std::cout << "libdynmeans: Trial: " << i+1 << "/" << nRestarts << " Objective: " << obj << " Old Uninst: " << numolduninst  << " Old Inst: " << numoldinst  << " New: " << numnew <<  "                   \r" << std::flush; 
-			}
-		} while(prevobj > obj);
+	if (nRestarts <= 0){
+		std::cout << "libdynmeans: ERROR: Cannot have nRestarts <= 0" << std::endl;
+		return;
+	}
+	if (chunkObs <= 0){
+		std::cout << "libdynmeans: ERROR: Cannot have chunkObs <= 0" << std::endl;
+		return;
+	}
+	if (this->streamOpen){
+		std::cout << "libdynmeans: ERROR: Call commitWindow to close the streaming window before calling clusterFile" << std::endl;
+		return;
+	}
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && dim != Vec::SizeAtCompileTime){
+		std::cout << "libdynmeans: ERROR: observation dimension " << dim << " does not match the vector type (" << Vec::SizeAtCompileTime << ")" << std::endl;
+		return;
+	}
+	if (this->assignType != EXHAUSTIVE){
+		std::cout << "libdynmeans: ERROR: clusterFile only supports EXHAUSTIVE assignment" << std::endl;
+		return;
+	}
+	std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+	if (!in){
+		std::cout << "libdynmeans: ERROR: Cannot open " << path << std::endl;
+		return;
+	}
+	const long long bytes = in.tellg();
+	const long long rowBytes = (long long)dim*sizeof(Scalar);
+	if (dim <= 0 || bytes <= 0 || bytes % rowBytes != 0 || bytes/rowBytes > std::numeric_limits<int>::max()){
+		std::cout << "libdynmeans: ERROR: " << path << " does not hold a whole number of observations of dimension " << dim << std::endl;
+		return;
+	}
+	this->obsLayout = DENSE_WINDOW;
+	this->nObs = bytes/rowBytes;
+	this->obsDim = this->obsStride = dim;
+	const uint64_t windowSeed = this->nextWindowSeed();
 
-		if (obj < finalObj){
-			finalObj = obj;
-			finalParams = prms;
-			finalLabels = lbls;
-			finalCnts = cnts;
+	if (verbose){
+		std::cout << "libdynmeans: Clustering " << this->nObs << " datapoints from " << path << " with " << nRestarts << " restarts." << std::endl;
+	}
+	//the restarts run one after another, each streaming the file once per sweep through the same two chunk buffers
+	std::vector<Scalar> bufs[2];
+	bufs[0].resize((size_t)std::min(chunkObs, this->nObs)*dim);
+	bufs[1].resize(bufs[0].size());
+	//(value-initialized like the workers' workspaces in clusterWindow, since swapping them copies every field)
+	Workspace ws = Workspace(), best = Workspace();
+	double bestObj = std::numeric_limits<double>::max();
+	bool ok = true;
+	for (int restart = 0; restart < nRestarts && ok; restart++){
+		double obj = this->runFileRestart(in, restart, windowSeed, chunkObs, bufs, ws, ok);
+		if (ok && obj < bestObj){
+			bestObj = obj;
+			std::swap(best, ws);
 		}
 	}
+	this->obsData = NULL;
+	this->obsOffset = 0;
+	if (!ok){
+		std::cout << "libdynmeans: ERROR: Failed to read " << path << std::endl;
+		return;
+	}
+	this->recall = -1;
+	finalObj = bestObj;
+	finalParams = best.prms;
 	if (verbose){
-		int numinst = 0;
-		for (int ii = 0; ii < finalCnts.size(); ii++){
-			if (finalCnts[ii] > 0){
-				numinst++;
-			}
-		}
-		int numnew = finalParams.size() - this->oldprms.size();
-		int numoldinst = numinst - numnew;
-		int numolduninst = finalCnts.size() - numinst;
-		std::cout << "libdynmeans: Done clustering. Min Objective: " << finalObj << " Old Uninst: " << numolduninst  << " Old Inst: " << numoldinst  << " New: " << numnew <<  std::endl;
+		std::cout << "libdynmeans: Done clustering. Min Objective: " << finalObj << std::endl;
 	}
-	//update the stored results to the one with minimum cost
-	finalLabels = this->updateState(finalLabels, finalCnts, finalParams);
+	finalLabels = best.lbls;
+	this->updateState(finalLabels, best.wts, best.prms);
 	timeval tCur;
 	gettimeofday(&tCur, NULL);
 	tTaken = (double)(tCur.tv_sec - tStart.tv_sec) + (double)(tCur.tv_usec - tStart.tv_usec)/1.0e6;
-
-	return;
 }
 
-
+//one restart of clusterFile: the same iteration as runRestart, with every sweep streamed from the file
 template<class Vec>
-void DynMeans<Vec>::assignObservations(std::vector<int> assgnOrdering, std::vector<int>& lbls, std::vector<int>& cnts, std::vector<Vec>& prms){
-	for (int i = 0; i < assgnOrdering.size(); i++){
-		//get the observation idx from the random ordering
-		int idx = assgnOrdering[i];
-
-		//store the old lbl for possibly deleting clusters later
-		int oldlbl = lbls[idx];
+double DynMeans<Vec>::runFileRestart(std::ifstream& in, const int restart, const uint64_t windowSeed, const int chunkObs, 
+		std::vector<Scalar>* bufs, Workspace& ws, bool& ok){
+	//the ordering is shuffled within each chunk, so a single chunk gives the same ordering as runRestart
+	SplitMix64 restartRng(windowSeed, restart);
+	ws.ordering.resize(this->nObs);
+	std::iota(ws.ordering.begin(), ws.ordering.end(), 0);
+	for (int begin = 0; begin < this->nObs; begin += chunkObs){
+		std::shuffle(ws.ordering.begin() + begin, ws.ordering.begin() + std::min(begin + chunkObs, this->nObs), restartRng);
+	}
+	this->clearClusters(ws, this->obsDim);
+	ws.lbls.assign(this->nObs, -1);
 
-		//calculate the distances to all the parameters
-		int minind = 0;
-		double mindistsq = std::numeric_limits<double>::max();
-		for (int j = 0; j < prms.size(); j++){
-			double tmpdistsq = (prms[j] - this->observations[idx]).squaredNorm();
-			if (cnts[j] == 0){//the only way cnts can get to 0 is if it's an old parameter
-				double gamma = 1.0/(1.0/this->weights[j] + this->ages[j]*this->tau);
-				tmpdistsq = gamma/(1.0+gamma)*tmpdistsq + this->ages[j]*this->Q;
-			}
-			if(tmpdistsq < mindistsq){
-				minind = j;
-				mindistsq = tmpdistsq;
-			}
+	double obj, prevobj;
+	obj = prevobj = std::numeric_limits<double>::max();
+	do {
+		prevobj = obj;
+		if (!this->sweepFile(in, chunkObs, bufs, ws)){
+			ok = false;
+			return std::numeric_limits<double>::max();
 		}
+		obj = this->setParameters(ws);
+		Step::checkMonotone(obj, prevobj);
+	} while(prevobj > obj);
+	this->compactSlots(ws);
+	return obj;
+}
 
-		//if the minimum distance is stil greater than lambda + startup cost, start a new cluster
-		if (mindistsq > this->lambda){
-			prms.push_back(this->observations[idx]);
-			lbls[idx] = prms.size()-1;
-			cnts.push_back(1);
-		} else {
-			if (cnts[minind] == 0){ //if we just instantiated an old cluster
-						//update its parameter to the current timestep
-						//so that upcoming assignments are valid
-				double gamma = 1.0/(1.0/this->weights[minind] + this->ages[minind]*this->tau);
-				prms[minind] = (this->oldprms[minind]*gamma + this->observations[idx])/(gamma + 1);
-			}
-			lbls[idx] = minind;
-			cnts[minind]++;
+//one assignment sweep over the file: chunk c+1 is read on a second thread while the observations of chunk c
+//are assigned in the restart's ordering; the view is pointed at each chunk in turn, offset by its first index
+template<class Vec>
+bool DynMeans<Vec>::sweepFile(std::ifstream& in, const int chunkObs, std::vector<Scalar>* bufs, Workspace& ws){
+	const int nChunks = (this->nObs + chunkObs - 1)/chunkObs;
+	const long long rowBytes = (long long)this->obsDim*sizeof(Scalar);
+	bool readOk = true;
+	auto readChunk = [&](int c, std::vector<Scalar>& buf){
+		const int begin = c*chunkObs;
+		const int n = std::min(chunkObs, this->nObs - begin);
+		in.clear();
+		in.seekg(begin*rowBytes);
+		in.read((char*)&buf[0], n*rowBytes);
+		readOk = readOk && (bool)in;
+	};
+	readChunk(0, bufs[0]);
+	for (int c = 0; c < nChunks && readOk; c++){
+		std::thread reader;
+		if (c+1 < nChunks){
+			reader = std::thread(readChunk, c+1, std::ref(bufs[(c+1)%2]));
 		}
-
-
-		//if obs was previously assigned to something, decrease the count the clus it was assigned to
-		//we do cluster deletion *after* assignment to prevent corner cases with monotonicity
-		if (oldlbl != -1){
-			cnts[oldlbl]--;
-			//if this cluster now has no observations, but was a new one (no age recording for it yet)
-			//remove it and shift labels downwards
-			if (cnts[oldlbl] == 0 && oldlbl >= this->oldprms.size()){
-				prms.erase(prms.begin() + oldlbl);
-				cnts.erase(cnts.begin() + oldlbl);
-				for (int j = 0; j < lbls.size(); j++){
-					if (lbls[j] > oldlbl){
-						lbls[j]--;
-					}
-				}
-			} else if (cnts[oldlbl] == 0){//it was an old parameter, reset it to the oldprm
-				prms[oldlbl] = this->oldprms[oldlbl];
-			}
+		const int begin = c*chunkObs;
+		const int end = std::min(begin + chunkObs, this->nObs);
+		this->obsData = &bufs[c%2][0];
+		this->obsOffset = begin;
+		for (int i = begin; i < end; i++){
+			this->assignObservation(ws, ws.ordering[i]);
+		}
+		if (reader.joinable()){
+			reader.join();
 		}
 	}
-	return;	
+	return readOk;
 }
 
 template<class Vec>
-double DynMeans<Vec>::setParameters(std::vector<int>& lbls, std::vector<int>& cnts, std::vector<Vec>& prms){
-	double objective = 0;
-	for (int i = 0; i < prms.size(); i++){
-		if (cnts[i] > 0){
-			//add cost for new clusters - lambda
-			// or add cost for old clusters - Q
-			if (i < this->oldprms.size()){
-				objective += this->Q*this->ages[i];
-			} else {
-				objective += this->lambda;
-			}
-			std::vector<Vec> obsInClus = this->getObsInCluster(i, lbls);
-			Vec tmpvec = obsInClus[0];
-			for (int j = 1; j < obsInClus.size(); j++){
-				tmpvec = tmpvec + obsInClus[j];
-			}
-			tmpvec = tmpvec / obsInClus.size();
-			if (i < this->oldprms.size()){ //updating an old param
-				double gamma = 1.0/(1.0/this->weights[i] + this->ages[i]*this->tau);
-				prms[i] = (this->oldprms[i]*gamma + tmpvec*cnts[i])/(gamma + cnts[i]);
-				//add parameter lag cost
-				double tmpsqdist = (prms[i] - this->oldprms[i]).squaredNorm();
-				objective += gamma*tmpsqdist;
-			} else { //just setting a new param
-				prms[i] = tmpvec;
-				//no lag cost for new params
-			}
-			//get cost for prms[i]
-			for (int j = 0; j < obsInClus.size(); j++){
-				objective += (prms[i] - obsInClus[j]).squaredNorm();
-			}
-		}
-	}
+void DynMeans<Vec>::clusterWindow(int nRestarts, 
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	timeval tStart;
+	gettimeofday(&tStart, NULL);
+
+	if (nRestarts <= 0){
+		std::cout << "libdynmeans: ERROR: Cannot have nRestarts <= 0" << std::endl;
+		return;
+	}
+	if (this->streamOpen){
+		std::cout << "libdynmeans: ERROR: Call commitWindow to close the streaming window before calling cluster" << std::endl;
+		return;
+	}
+
+	//each restart generates its own assignment ordering from a stream keyed by (windowSeed, restart)
+	//so the result does not depend on the number of threads or how restarts get scheduled
+	const uint64_t windowSeed = this->nextWindowSeed();
+
+	if (verbose){
+		std::cout << "libdynmeans: Clustering " << this->nObs << " datapoints with " << nRestarts << " restarts." << std::endl;
+	}
+	if (this->obsLayout == SPARSE_WINDOW){
+		this->obsNorms.assign(this->nObs, 0.0);
+		for (int i = 0; i < this->nObs; i++){
+			for (int k = this->obsRowPtr[i]; k < this->obsRowPtr[i+1]; k++){
+				this->obsNorms[i] += (double)this->obsVals[k]*(double)this->obsVals[k];
+			}
+		}
+	} else if (this->obsLayout == QUANTIZED_WINDOW){
+		this->obsNorms.resize(this->nObs);
+		for (int i = 0; i < this->nObs; i++){
+			const double scale = this->obsScales[i];
+			this->obsNorms[i] = scale*scale*quantizedNormSq(this->obsCodes + (size_t)i*this->obsStride, this->obsDim);
+		}
+		//(the codes are bounded by 127 times their scale, so the matrix product search takes them about the origin and
+		//reuses these norms)
+		this->gemmOrigin.setZero(this->obsDim);
+	} else if (this->useGemm()){
+		//the products are taken about the mean of the window, so that they don't cancel away the clusters' spread
+		//when the data is far from the origin
+		AccumVec mean = AccumVec::Zero(this->obsDim);
+		for (int i = 0; i < this->nObs; i++){
+			mean += this->obs(i).template cast<double>();
+		}
+		this->gemmOrigin = (mean/std::max(this->nObs, 1)).transpose().template cast<Scalar>();
+		this->obsNorms.resize(this->nObs);
+		for (int i = 0; i < this->nObs; i++){
+			this->obsNorms[i] = (this->obs(i).transpose() - this->gemmOrigin).template cast<double>().squaredNorm();
+		}
+	}
+	if (this->useOldDists){
+		this->computeOldDistances();
+	}
+	if (this->warmStart){
+		this->computeWarmLabels();
+	}
+
+	//run the restarts in the caller's workspace if there is one; every worker keeps the best restart it ran
+	//(one after another when sharded, where the shards do the parallel work in one shared segment)
+	ClusterWorkspace localWs;
+	ClusterWorkspace& cw = (this->cws != NULL ? *this->cws : localWs);
+	const int nWorkers = (!this->shardedSweep.empty() ? 1 : std::min(this->nThreads, nRestarts));
+	if (cw.workers.size() < nWorkers){
+		cw.workers.resize(nWorkers);
+		cw.bests.resize(nWorkers);
+	}
+	std::vector<Workspace>& bestWs = cw.bests;
+	std::vector<double>& bestObjs = cw.bestObjs;
+	std::vector<int>& bestRestarts = cw.bestRestarts;
+	std::vector<long>& recallHits = cw.recallHits;
+	std::vector<long>& recallSamples = cw.recallSamples;
+	bestObjs.assign(nWorkers, std::numeric_limits<double>::max());
+	bestRestarts.assign(nWorkers, -1);
+	recallHits.assign(nWorkers, 0);
+	recallSamples.assign(nWorkers, 0);
+	std::atomic<int> nextRestart(0), nPruned(0);
+	FixedPoints fixedPoints;
+	FixedPoints* prune = (this->pruneRestarts && this->assignType != APPROXIMATE ? &fixedPoints : NULL);
+	if (nWorkers == 1){
+		this->restartWorker(nextRestart, nRestarts, windowSeed, prune, nPruned,
+				cw.workers[0], bestWs[0], bestObjs[0], bestRestarts[0], recallHits[0], recallSamples[0]);
+	} else {
+		std::vector<std::thread> workers;
+		for (int i = 0; i < nWorkers; i++){
+			workers.push_back(std::thread(&DynMeans<Vec>::restartWorker, this, std::ref(nextRestart), nRestarts, windowSeed, prune, std::ref(nPruned),
+						std::ref(cw.workers[i]), std::ref(bestWs[i]), std::ref(bestObjs[i]), std::ref(bestRestarts[i]), std::ref(recallHits[i]), std::ref(recallSamples[i])));
+		}
+		for (int i = 0; i < nWorkers; i++){
+			workers[i].join();
+		}
+	}
+
+	//reduce to the minimum objective, breaking ties by restart index so the result is deterministic
+	int bestWorker = -1;
+	for (int i = 0; i < nWorkers; i++){
+		if (bestRestarts[i] < 0){
+			continue;
+		}
+		if (bestWorker < 0 || bestObjs[i] < bestObjs[bestWorker] 
+				|| (bestObjs[i] == bestObjs[bestWorker] && bestRestarts[i] < bestRestarts[bestWorker])){
+			bestWorker = i;
+		}
+	}
+	this->nPruned = nPruned;
+	finalObj = bestObjs[bestWorker];
+	finalParams = bestWs[bestWorker].prms;
+	finalLabels = bestWs[bestWorker].lbls;
+	std::vector<int>& finalCnts = bestWs[bestWorker].cnts;
+	std::vector<double>& finalWts = bestWs[bestWorker].wts;
+	if (this->assignType == APPROXIMATE){
+		long hits = std::accumulate(recallHits.begin(), recallHits.end(), 0L);
+		long samples = std::accumulate(recallSamples.begin(), recallSamples.end(), 0L);
+		this->recall = (samples > 0 ? (double)hits/samples : 1.0);
+	} else {
+		this->recall = -1;
+	}
+
+	if (verbose){
+		int numinst = 0;
+		for (int ii = 0; ii < finalCnts.size(); ii++){
+			if (finalCnts[ii] > 0){
+				numinst++;
+			}
+		}
+		int numnew = finalParams.size() - this->oldprms.size();
+		int numoldinst = numinst - numnew;
+		int numolduninst = finalCnts.size() - numinst;
+		std::cout << "libdynmeans: Done clustering. Min Objective: " << finalObj << " Old Uninst: " << numolduninst  << " Old Inst: " << numoldinst  << " New: " << numnew <<  std::endl;
+		if (this->assignType == APPROXIMATE){
+			std::cout << "libdynmeans: Approximate assignment recall: " << this->recall << std::endl;
+		}
+		if (prune != NULL){
+			std::cout << "libdynmeans: Pruned " << this->nPruned << "/" << nRestarts << " restarts" << std::endl;
+		}
+	}
+	//update the stored results to the one with minimum cost
+	this->updateState(finalLabels, finalWts, finalParams);
+	timeval tCur;
+	gettimeofday(&tCur, NULL);
+	tTaken = (double)(tCur.tv_sec - tStart.tv_sec) + (double)(tCur.tv_usec - tStart.tv_usec)/1.0e6;
+
+	//the view (and the distance table built on it) only lives for the duration of the call
+	this->obsLayout = DENSE_WINDOW;
+	this->obsData = NULL;
+	this->obsOffset = 0;
+	this->obsRowPtr = this->obsColIdx = NULL;
+	this->obsVals = NULL;
+	this->obsCodes = NULL;
+	this->obsScales = NULL;
+	this->obsWeights = NULL;
+	this->oldDistsReady = false;
+	return;
+}
+
+template<class Vec>
+void DynMeans<Vec>::restartWorker(std::atomic<int>& nextRestart, const int nRestarts, const uint64_t windowSeed, FixedPoints* fixedPoints,
+		std::atomic<int>& nPruned, Workspace& ws, Workspace& best, double& bestObj, int& bestRestart, long& recallHits, long& recallSamples) const{
+	for (int i = nextRestart++; i < nRestarts; i = nextRestart++){
+		double obj = this->runRestart(i, nRestarts, windowSeed, fixedPoints, ws);
+		if (this->assignType == APPROXIMATE){
+			const GraphState& gr = boost::get<GraphState>(ws.mode);
+			recallHits += gr.recallHits;
+			recallSamples += gr.recallSamples;
+		}
+		nPruned += ws.pruned;
+		if (obj == std::numeric_limits<double>::max()){
+			continue;
+		}
+		//restarts are pulled in increasing order, so a strict comparison keeps the lowest index on ties
+		if (obj < bestObj){
+			bestObj = obj;
+			bestRestart = i;
+			std::swap(best, ws); //ws picks up the old best's buffers for reuse
+		}
+	}
+}
+
+//window w's restart streams are keyed by the first word of stream (seed, w)
+template<class Vec>
+uint64_t DynMeans<Vec>::nextWindowSeed(){
+	return SplitMix64(this->seed, this->nWindows++)();
+}
+
+template<class Vec>
+double DynMeans<Vec>::runRestart(const int restart, const int nRestarts, const uint64_t windowSeed, FixedPoints* fixedPoints, Workspace& ws) const{
+	//generate the ordering from this restart's own random stream
+	SplitMix64 restartRng(windowSeed, restart);
+	ws.ordering.resize(this->nObs);
+	std::iota(ws.ordering.begin(), ws.ordering.end(), 0);
+	std::shuffle(ws.ordering.begin(), ws.ordering.end(), restartRng);
+
+	this->clearClusters(ws, this->obsDim);
+	//Initialization: no label on anything
+	ws.lbls.assign(this->nObs, -1);
+	//warm start only the first restart, so the others keep the diversity of their own orderings (or seeds)
+	if (this->warmStart && restart == 0){
+		this->applyLabels(ws, this->warmLbls);
+	} else if (this->seeded){
+		this->seedParameters(ws, restartRng);
+	}
+	if (this->obsLayout != DENSE_WINDOW){
+		ws.pnorms.resize(ws.prms.size());
+		for (int j = 0; j < ws.prms.size(); j++){
+			ws.pnorms[j] = ws.prms[j].template cast<double>().squaredNorm();
+		}
+	}
+	if (this->assignType == BOUNDED){
+		this->resetBounds(ws);
+	} else if (this->assignType == PACKED){
+		this->resetPacked(ws);
+	} else if (this->assignType == KDTREE){
+		this->rebuildTree(ws);
+	} else if (this->assignType == APPROXIMATE){
+		GraphState& gr = startMode<GraphState>(ws);
+		gr.graphRng.seed(restartRng());
+		gr.nQueries = gr.recallHits = gr.recallSamples = 0;
+		this->rebuildGraph(ws);
+	} else if (this->assignType == BATCH){
+		BatchState& bat = startMode<BatchState>(ws);
+		//BATCH sweeps get the threads that aren't running other restarts
+		bat.sweepThreads = std::max(1, this->nThreads/std::min(this->nThreads, nRestarts));
+		if (this->useGemm()){
+			this->resetGemm(ws);
+		}
+	} else {
+		ws.mode = boost::blank();
+	}
+	ws.canon.clear();
+	size_t hash = 0;
+	ws.pruned = false;
+
+	double obj, prevobj;
+	obj = prevobj = std::numeric_limits<double>::max();
+
+	do {
+		//do the kmeans iteration
+		prevobj = obj;
+		this->assignObservations(ws);
+		obj = this->setParameters(ws);
+		//the statistics are updated incrementally (and float distances are rounded), so allow for round-off
+		Step::checkMonotone(obj, prevobj);
+		//restart pruning: the sweeps from here on depend only on the labels (the parameters are set from them), and a
+		//fixed point's sweep moves nothing whatever the ordering, so if a lower restart converged to these labels this
+		//one would end right here, with the objective it has now. That loses to the lower restart unless round-off puts
+		//it below, in which case the restart stops here as the converged result
+		if (fixedPoints != NULL){
+			ws.prevCanon.swap(ws.canon);
+			hash = this->canonicalLabels(ws);
+			std::lock_guard<std::mutex> lock(fixedPoints->mtx);
+			for (int j = 0; j < fixedPoints->restarts.size() && !ws.pruned; j++){
+				if (fixedPoints->restarts[j] < restart && fixedPoints->hashes[j] == hash && fixedPoints->lbls[j] == ws.canon){
+					ws.pruned = true;
+					if (obj >= fixedPoints->objs[j]){
+						return std::numeric_limits<double>::max();
+					}
+				}
+			}
+		}
+		if (verbose && this->nThreads == 1){ //progress lines from several threads would interleave
+			int numinst = 0;
+			for (int ii = 0; ii < ws.cnts.size(); ii++){
+				if (ws.cnts[ii] > 0){
+					numinst++;
+				}
+			}
+			int numnew = ws.prms.size() - this->oldprms.size() - ws.freeSlots.size();
+			int numoldinst = numinst - numnew;
+			int numolduninst = ws.cnts.size() - numinst;
+		std::cout << "libdynmeans: Trial: " << restart+1 << "/" << nRestarts << " Objective: " << obj << " Old Uninst: " << numolduninst  << " Old Inst: " << numoldinst  << " New: " << numnew <<  "                   \r" << std::flush; 
+		}
+	} while(prevobj > obj && !ws.pruned);
+	this->compactSlots(ws);
+	//publish the labels for the higher restarts if the last sweep left them unchanged (the objective can also stop
+	//decreasing on a sweep that moves tied points)
+	if (fixedPoints != NULL && !ws.pruned && ws.canon == ws.prevCanon){
+		std::lock_guard<std::mutex> lock(fixedPoints->mtx);
+		fixedPoints->restarts.push_back(restart);
+		fixedPoints->hashes.push_back(hash);
+		fixedPoints->objs.push_back(obj);
+		fixedPoints->lbls.push_back(ws.canon);
+	}
+	return obj;
+}
+
+//sets ws.canon to the labels with slot numbering that doesn't depend on the restart: old parameters keep their index,
+//and new clusters are numbered after them in order of their first observation. Returns a hash of them
+template<class Vec>
+size_t DynMeans<Vec>::canonicalLabels(Workspace& ws) const{
+	const int K0 = this->oldprms.size();
+	ws.slotMap.assign(ws.prms.size(), -1);
+	ws.canon.resize(this->nObs);
+	int nxt = K0;
+	size_t hash = 0;
+	for (int i = 0; i < this->nObs; i++){
+		const int j = ws.lbls[i];
+		if (j >= K0 && ws.slotMap[j] < 0){
+			ws.slotMap[j] = nxt++;
+		}
+		ws.canon[i] = (j < K0 ? j : ws.slotMap[j]);
+		hash = hash*1000003u ^ (size_t)ws.canon[i];
+	}
+	return hash;
+}
+
+//starts the clusters of a window: the old parameters are placeholders with count 0, shifted to themselves
+template<class Vec>
+void DynMeans<Vec>::clearClusters(Workspace& ws, const int dim) const{
+	ws.prms = this->oldprms;
+	Step::clearClusters(ws, this->oldprms.size(), dim);
+}
+
+//removes the dead new-cluster slots left by assignObservations and relabels the observations, once per restart
+template<class Vec>
+void DynMeans<Vec>::compactSlots(Workspace& ws) const{
+	Step::compactSlots(ws, this->oldprms.size());
+}
+
+//D^2 seeding, adapted to the DynMeans costs (greedy k-means++ as a facility location problem with opening cost lambda):
+//the old parameters are the initial seeds, at distance gamma/(1+gamma)*d^2 (their revival cost age*Q is paid once per
+//cluster rather than per observation, so it is left out here). Each round draws
+//a few candidate observations with probability proportional to their distance to the closest seed, and keeps the one
+//that lowers sum_i min(distance to closest seed) the most, as long as that is by more than lambda.
+//Each observation is then labelled with its closest seed and the parameters are set from those labels,
+//so the first assignment sweep starts from a spread-out set of clusters rather than from the ordering.
+//Costs O(nTrials*nObs*d) per new seed.
+template<class Vec>
+void DynMeans<Vec>::seedParameters(Workspace& ws, SplitMix64& rng) const{
+	std::vector<double> mind(this->nObs, std::numeric_limits<double>::max()), cand(this->nObs), best(this->nObs), wmind(this->nObs);
+	std::vector<int> nearest(this->nObs, -1);
+	for (int j = 0; j < this->oldprms.size(); j++){
+		double scale, offset;
+		this->penalty(ws, j, scale, offset);
+		const double pnorm = this->paramNorm(ws.prms[j]);
+		for (int i = 0; i < this->nObs; i++){
+			double d = scale*this->obsDistSq(ws.prms[j], pnorm, i); //no offset, see above
+			if (d < mind[i]){
+				mind[i] = d;
+				nearest[i] = j;
+			}
+		}
+	}
+	while (true){
+		//with no seeds at all, the first one is drawn uniformly and always kept
+		const bool first = (nearest[0] < 0);
+		const int nTrials = (first ? 1 : 2 + (int)log((double)ws.prms.size() + 1.0));
+		std::discrete_distribution<int> pick;
+		if (!first){
+			for (int i = 0; i < this->nObs; i++){
+				wmind[i] = this->obsWeight(i)*mind[i];
+			}
+			pick = std::discrete_distribution<int>(wmind.begin(), wmind.end());
+		}
+		int bestObs = -1;
+		double bestGain = this->lambda;
+		Vec candPrm;
+		for (int t = 0; t < nTrials; t++){
+			const int c = (first ? std::uniform_int_distribution<int>(0, this->nObs-1)(rng) : pick(rng));
+			this->setToObservation(candPrm, c);
+			const double cnorm = this->paramNorm(candPrm);
+			double gain = 0;
+			for (int i = 0; i < this->nObs; i++){
+				cand[i] = this->obsDistSq(candPrm, cnorm, i);
+				if (cand[i] < mind[i]){
+					gain += (first ? 1.0 : this->obsWeight(i)*(mind[i] - cand[i]));
+				}
+			}
+			if (first || gain > bestGain){
+				bestGain = gain;
+				bestObs = c;
+				best.swap(cand);
+			}
+		}
+		if (bestObs < 0){
+			break;
+		}
+		Vec x;
+		this->setToObservation(x, bestObs);
+		const int j = Step::newSlot(ws, x);
+		for (int i = 0; i < this->nObs; i++){
+			if (best[i] < mind[i]){
+				mind[i] = best[i];
+				nearest[i] = j;
+			}
+		}
+	}
+	this->applyLabels(ws, nearest);
+}
+
+//fills the table of penalized distances to the old parameters, splitting the observations among the threads
+template<class Vec>
+void DynMeans<Vec>::computeOldDistances(){
+	this->oldDists.resize((size_t)this->nObs*this->oldprms.size());
+	const int nWorkers = std::max(1, std::min(this->nThreads, this->nObs/256));
+	if (nWorkers == 1){
+		this->oldDistanceRows(0, this->nObs);
+	} else {
+		std::vector<std::thread> workers;
+		for (int i = 0; i < nWorkers; i++){
+			workers.push_back(std::thread(&DynMeans<Vec>::oldDistanceRows, this, 
+						(int)((long)this->nObs*i/nWorkers), (int)((long)this->nObs*(i+1)/nWorkers)));
+		}
+		for (int i = 0; i < nWorkers; i++){
+			workers[i].join();
+		}
+	}
+	this->oldDistsReady = true;
+}
+
+//table rows [begin, end), with the same arithmetic as nearestParameter so the lookups are bit-identical
+template<class Vec>
+void DynMeans<Vec>::oldDistanceRows(int begin, int end){
+	const int nOld = this->oldprms.size();
+	for (int j = 0; j < nOld; j++){
+		double gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+		const double pnorm = this->paramNorm(this->oldprms[j]);
+		for (int i = begin; i < end; i++){
+			const double w = this->obsWeight(i);
+			this->oldDists[(size_t)i*nOld + j] = Step::revivalDistSq(gamma, this->ages[j]*this->Q, w, this->obsDistSq(this->oldprms[j], pnorm, i));
+		}
+	}
+}
+
+//the warm start labels: each observation's nearest old parameter at distance gamma/(1+gamma)*d^2 (as in the seeding),
+//or -1 if none is within lambda, in which case the first sweep decides
+template<class Vec>
+void DynMeans<Vec>::computeWarmLabels(){
+	std::vector<double>& mind = this->warmDists;
+	mind.resize(this->nObs);
+	for (int i = 0; i < this->nObs; i++){
+		mind[i] = this->lambda/this->obsWeight(i);
+	}
+	this->warmLbls.assign(this->nObs, -1);
+	for (int j = 0; j < this->oldprms.size(); j++){
+		const double gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+		const double pnorm = this->paramNorm(this->oldprms[j]);
+		for (int i = 0; i < this->nObs; i++){
+			double d = gamma/(gamma+this->obsWeight(i))*this->obsDistSq(this->oldprms[j], pnorm, i);
+			if (d <= mind[i]){
+				mind[i] = d;
+				this->warmLbls[i] = j;
+			}
+		}
+	}
+}
+
+//starts a restart from the given labels (-1 = unlabelled), which may refer to any of ws.prms: fills in the counts
+//and sufficient statistics, drops new parameters that got no observations, and sets the labelled parameters
+template<class Vec>
+void DynMeans<Vec>::applyLabels(Workspace& ws, const std::vector<int>& lbls) const{
+	for (int i = 0; i < this->nObs; i++){
+		const int j = lbls[i];
+		ws.lbls[i] = j;
+		if (j < 0){
+			continue;
+		}
+		ws.cnts[j]++;
+		this->addObservation(ws, j, i, 1);
+	}
+	//(a seed can lose its own observation to an identical earlier one)
+	for (int j = this->oldprms.size(); j < ws.prms.size(); j++){
+		if (ws.cnts[j] == 0){
+			ws.freeSlots.push_back(j);
+		}
+	}
+	this->compactSlots(ws);
+	for (int j = 0; j < ws.prms.size(); j++){
+		if (ws.cnts[j] > 0){
+			this->updateParameter(ws, j);
+		}
+	}
+}
+
+template<class Vec>
+void DynMeans<Vec>::assignObservations(Workspace& ws) const{
+	if (!this->shardedSweep.empty()){
+		this->shardedSweep(ws);
+		return;
+	}
+	if (this->assignType == BATCH){
+		this->assignObservationsBatch(ws);
+		return;
+	}
+	if (this->assignType == APPROXIMATE){
+		const GraphState& gr = boost::get<GraphState>(ws.mode);
+		if (gr.graphChanges > gr.graph.size()/4){
+			this->rebuildGraph(ws);
+		}
+	}
+	for (int i = 0; i < ws.ordering.size(); i++){
+		//get the observation idx from the random ordering
+		this->assignObservation(ws, ws.ordering[i]);
+	}
+	return;	
+}
+
+//one step of the sequential sweep: moves observation idx to its nearest (penalized) parameter or to a new cluster,
+//updating the counts/statistics and the parameter of an old cluster it instantiates
+template<class Vec>
+void DynMeans<Vec>::assignObservation(Workspace& ws, const int idx) const{
+	const std::vector<Vec>& prms = ws.prms;
+	//find the parameter with minimum (penalized) distance
+	int minind = 0;
+	double mindistsq = std::numeric_limits<double>::max();
+	if (this->assignType == BOUNDED){
+		this->nearestParameterBounded(ws, idx, minind, mindistsq);
+	} else if (this->assignType == PACKED){
+		PackedState& pk = boost::get<PackedState>(ws.mode);
+		packedDistances<Vec::RowsAtCompileTime>(&pk.pctrs[0], pk.pcap, &pk.pscale[0], &pk.poffset[0], 
+				this->obsData + (size_t)idx*this->obsStride, this->obsDim, prms.size(), &pk.pdists[0]);
+		packedArgMin(&pk.pdists[0], prms.size(), minind, mindistsq);
+	} else if (this->assignType == KDTREE){
+		this->nearestParameterTree(ws, idx, minind, mindistsq);
+	} else if (this->assignType == APPROXIMATE){
+		this->nearestParameterApprox(ws, idx, minind, mindistsq);
+	} else {
+		this->nearestParameter(ws, idx, minind, mindistsq);
+	}
+	this->moveObservation(ws, idx, minind, mindistsq);
+}
+
+//applies the outcome of the search in assignObservation: observation idx goes to parameter minind at (penalized)
+//distance mindistsq, or to a new cluster if that is above lambda
+template<class Vec>
+void DynMeans<Vec>::moveObservation(Workspace& ws, const int idx, const int minind, const double mindistsq) const{
+	std::vector<int>& lbls = ws.lbls;
+	std::vector<int>& cnts = ws.cnts;
+
+	//store the old lbl for possibly deleting clusters later
+	int oldlbl = lbls[idx];
+
+	//if the minimum distance is stil greater than lambda + startup cost, start a new cluster
+	//in a free slot if one was left behind by a dead cluster, otherwise in a new one
+	//(distances are per unit weight, so a point of weight w pays lambda/w per unit for a cluster of its own)
+	if (mindistsq > this->lambda/this->obsWeight(idx)){
+		Vec x;
+		this->setToObservation(x, idx);
+		const int slot = Step::newSlot(ws, x);
+		cnts[slot] = 1;
+		this->addObservation(ws, slot, idx, 1);
+		lbls[idx] = slot;
+		this->paramChanged(ws, slot);
+	} else {
+		if (cnts[minind] == 0){ //if we just instantiated an old cluster
+					//update its parameter to the current timestep
+					//so that upcoming assignments are valid
+			this->reviveParameter(ws, minind, idx);
+			cnts[minind]++;
+			this->paramChanged(ws, minind);
+		} else {
+			cnts[minind]++;
+		}
+		lbls[idx] = minind;
+		//keep the sufficient statistics bit-identical when the label doesn't change
+		if (minind != oldlbl){
+			this->addObservation(ws, minind, idx, 1);
+		}
+	}
+
+
+	//if obs was previously assigned to something, decrease the count the clus it was assigned to
+	//we do cluster deletion *after* assignment to prevent corner cases with monotonicity
+	if (oldlbl != -1){
+		cnts[oldlbl]--;
+		if (cnts[oldlbl] == 0){
+			this->clusterEmptied(ws, oldlbl);
+		} else if (lbls[idx] != oldlbl){
+			this->addObservation(ws, oldlbl, idx, -1);
+		}
+	}
+}
+
+//called when cluster j loses its last observation
+template<class Vec>
+void DynMeans<Vec>::clusterEmptied(Workspace& ws, const int j) const{
+	//a new cluster's slot is freed for reuse (slots are compacted at the end of the restart)
+	Step::emptyCluster(ws, j, this->oldprms.size());
+	if (j < this->oldprms.size()){//it was an old parameter, reset it to the oldprm
+		ws.prms[j] = this->oldprms[j];
+	}
+	this->paramChanged(ws, j);
+}
+
+//Lloyd-style sweep for BATCH assignment, in two phases that each keep the objective monotone:
+//1) every observation finds its nearest parameter against the parameters as they are at the start of the sweep,
+//   in parallel over the mode's sweepThreads threads (the search is read-only, so the threads need no synchronization)
+//2) observations whose nearest is a strictly closer instantiated cluster move there all at once; with the parameters
+//   frozen each such move lowers the objective, and clusters they empty are removed afterwards. The few observations
+//   that need a new cluster or to instantiate an old one (or have no label yet) then go through the sequential step
+//   in the restart's ordering, since each of those changes the parameters the others would see.
+//The moves are applied serially in the ordering, so the result does not depend on the number of threads.
+template<class Vec>
+void DynMeans<Vec>::assignObservationsBatch(Workspace& ws) const{
+	BatchState& bat = boost::get<BatchState>(ws.mode);
+	if (std::count(ws.lbls.begin(), ws.lbls.end(), -1) == this->nObs){
+		//nothing is labelled yet (first sweep), so every observation would go through the sequential step anyway
+		for (int i = 0; i < ws.ordering.size(); i++){
+			this->assignObservation(ws, ws.ordering[i]);
+		}
+		return;
+	}
+	bat.bcand.resize(this->nObs);
+	bat.bdist.resize(this->nObs);
+	const int nWorkers = std::max(1, std::min(bat.sweepThreads, this->nObs/256));
+	if (nWorkers == 1){
+		this->nearestParameterRange(ws, 0, this->nObs);
+	} else {
+		std::vector<std::thread> workers;
+		for (int i = 0; i < nWorkers; i++){
+			workers.push_back(std::thread(&DynMeans<Vec>::nearestParameterRange, this, std::ref(ws), 
+						(int)((long)this->nObs*i/nWorkers), (int)((long)this->nObs*(i+1)/nWorkers)));
+		}
+		for (int i = 0; i < nWorkers; i++){
+			workers[i].join();
+		}
+	}
+
+	bat.bwasInst.resize(ws.prms.size());
+	for (int j = 0; j < ws.prms.size(); j++){
+		bat.bwasInst[j] = (ws.cnts[j] > 0);
+	}
+	bat.bserial.clear();
+	bat.bemptied.clear();
+	for (int i = 0; i < ws.ordering.size(); i++){
+		const int idx = ws.ordering[i];
+		const int oldlbl = ws.lbls[idx];
+		const int c = bat.bcand[idx];
+		if (oldlbl != -1 && c == oldlbl){
+			continue; //nearest is still its own cluster, which is within lambda since it is instantiated
+		}
+		//clusters emptied earlier in this pass are only retired afterwards, so their parameters (and the
+		//distances to them) are still those of the snapshot
+		if (oldlbl == -1 || bat.bdist[idx] > this->lambda/this->obsWeight(idx) || !bat.bwasInst[c]){
+			bat.bserial.push_back(idx);
+			continue;
+		}
+		ws.cnts[c]++;
+		this->addObservation(ws, c, idx, 1);
+		ws.lbls[idx] = c;
+		if (--ws.cnts[oldlbl] == 0){
+			bat.bemptied.push_back(oldlbl);
+		} else {
+			this->addObservation(ws, oldlbl, idx, -1);
+		}
+	}
+	for (int i = 0; i < bat.bemptied.size(); i++){
+		if (ws.cnts[bat.bemptied[i]] == 0){ //it may have been refilled by a later move
+			this->clusterEmptied(ws, bat.bemptied[i]);
+		}
+	}
+	for (int i = 0; i < bat.bserial.size(); i++){
+		this->assignObservation(ws, bat.bserial[i]);
+	}
+}
+
+template<class Vec>
+bool DynMeans<Vec>::useGemm() const{
+	return this->assignType == BATCH && this->obsDim >= 32 && this->obsLayout != SPARSE_WINDOW;
+}
+
+//phase 1 of the batch sweep for observations [begin, end) in high dimension: the distances to all parameters come
+//from one matrix product per block of observations, ||x||^2 + ||c||^2 - 2*x.c, which runs at GEMM speed but loses
+//precision to cancellation. So the winner only proposes a move: its penalized distance (and the current label's) is
+//recomputed exactly, and the observation keeps its label unless the move is a strict improvement.
+template<class Vec>
+void DynMeans<Vec>::nearestParameterGemm(Workspace& ws, int begin, int end) const{
+	BatchState& bat = boost::get<BatchState>(ws.mode);
+	const int blockRows = 256;
+	const int K = ws.prms.size();
+	Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> xblk, dots;
+	for (int b = begin; b < end; b += blockRows){
+		const int nb = std::min(blockRows, end - b);
+		if (this->obsLayout == QUANTIZED_WINDOW){
+			//quantized windows are widened one block at a time, so the whole window is never held at full precision
+			xblk.resize(nb, this->obsDim);
+			for (int r = 0; r < nb; r++){
+				const int8_t* q = this->obsCodes + (size_t)(b + r)*this->obsStride;
+				const Scalar scale = this->obsScales[b + r];
+				for (int d = 0; d < this->obsDim; d++){
+					xblk(r, d) = scale*q[d];
+				}
+			}
+		} else {
+			RowMajorObsMap X(this->obsData + (size_t)b*this->obsStride, nb, this->obsDim, Eigen::OuterStride<>(this->obsStride));
+			xblk = X.rowwise() - this->gemmOrigin;
+		}
+		dots.noalias() = xblk*bat.gctrs.topRows(K).transpose();
+		for (int r = 0; r < nb; r++){
+			const int idx = b + r;
+			const double w = this->obsWeight(idx);
+			int minind = 0;
+			double mindistsq = std::numeric_limits<double>::max();
+			for (int j = 0; j < K; j++){
+				double d = std::max(this->obsNorms[idx] + bat.gnorms[j] - 2.0*dots(r, j), 0.0);
+				if (w != 1.0 && bat.ggamma[j] > 0){
+					d = bat.ggamma[j]/(bat.ggamma[j]+w)*d + bat.goffset[j]/w; //see nearestParameter
+				} else {
+					d = bat.gscale[j]*d + bat.goffset[j];
+				}
+				if (d < mindistsq){
+					minind = j;
+					mindistsq = d;
+				}
+			}
+			mindistsq = this->obsDistSq(ws, minind, idx);
+			if (w != 1.0 && bat.ggamma[minind] > 0){
+				mindistsq = bat.ggamma[minind]/(bat.ggamma[minind]+w)*mindistsq + bat.goffset[minind]/w;
+			} else {
+				mindistsq = bat.gscale[minind]*mindistsq + bat.goffset[minind];
+			}
+			const int curlbl = ws.lbls[idx];
+			if (curlbl != -1 && minind != curlbl){
+				double curdistsq = this->obsDistSq(ws, curlbl, idx); //instantiated, since idx is in it
+				if (curdistsq <= mindistsq){
+					minind = curlbl;
+					mindistsq = curdistsq;
+				}
+			}
+			bat.bcand[idx] = minind;
+			bat.bdist[idx] = mindistsq;
+		}
+	}
+}
+
+//phase 1 of the batch sweep for observations [begin, end)
+template<class Vec>
+void DynMeans<Vec>::nearestParameterRange(Workspace& ws, int begin, int end) const{
+	BatchState& bat = boost::get<BatchState>(ws.mode);
+	if (this->useGemm()){
+		this->nearestParameterGemm(ws, begin, end);
+		return;
+	}
+	for (int idx = begin; idx < end; idx++){
+		int minind = 0;
+		double mindistsq = std::numeric_limits<double>::max();
+		this->nearestParameter(ws, idx, minind, mindistsq);
+		bat.bcand[idx] = minind;
+		bat.bdist[idx] = mindistsq;
+	}
+}
+
+template<class Vec>
+void DynMeans<Vec>::nearestParameter(const Workspace& ws, int idx, int& minind, double& mindistsq) const{
+	const std::vector<int>& cnts = ws.cnts;
+	const std::vector<Vec>& prms = ws.prms;
+	const double* olddists = (this->oldDistsReady ? this->oldDists.data() + (size_t)idx*this->oldprms.size() : NULL);
+	//calculate the distances to all the parameters
+	for (int j = 0; j < prms.size(); j++){
+		if (cnts[j] == 0 && j >= this->oldprms.size()){ //dead slot
+			continue;
+		}
+		double tmpdistsq;
+		if (cnts[j] == 0){//the only live parameters with cnts 0 are old ones, still at oldprms[j]
+			if (olddists != NULL){
+				tmpdistsq = olddists[j];
+			} else {
+				//per unit weight: reviving j with a point of weight w costs gamma*w/(gamma+w)*d^2 + age*Q
+				const double w = this->obsWeight(idx);
+				double gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+				tmpdistsq = Step::revivalDistSq(gamma, this->ages[j]*this->Q, w, this->obsDistSq(ws, j, idx));
+			}
+		} else {
+			tmpdistsq = this->obsDistSq(ws, j, idx);
+		}
+		if(tmpdistsq < mindistsq){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+	}
+}
+
+//Same result as nearestParameter, but skips every parameter whose lower bound already exceeds the best distance found.
+//bnds holds, for each point and parameter, the last computed distance plus the parameter's drift at that time,
+//so subtracting the current drift gives a valid lower bound on the Euclidean distance (triangle inequality).
+//The penalized distance gamma/(1+gamma)*d^2 + age*Q is monotone in d, so it is bounded the same way.
+template<class Vec>
+void DynMeans<Vec>::nearestParameterBounded(Workspace& ws, int idx, int& minind, double& mindistsq) const{
+	BoundedState& bnd = boost::get<BoundedState>(ws.mode);
+	const std::vector<int>& cnts = ws.cnts;
+	const std::vector<Vec>& prms = ws.prms;
+	double* bnds = &bnd.bnds[(size_t)idx*bnd.bndCap];
+	//slack guards against rounding in the distance/sqrt/drift arithmetic
+	const double slack = std::max(1.0e-12, 64*(double)std::numeric_limits<Scalar>::epsilon());
+	const double w = this->obsWeight(idx);
+	//start from the current label, which is usually still the nearest
+	const int curlbl = ws.lbls[idx];
+	if (curlbl != -1){
+		mindistsq = this->obsDistSq(ws, curlbl, idx); //cnts[curlbl] > 0 since this point is in it
+		minind = curlbl;
+		bnds[curlbl] = sqrt(mindistsq) + bnd.drift[curlbl];
+	}
+	const double* olddists = (this->oldDistsReady ? this->oldDists.data() + (size_t)idx*this->oldprms.size() : NULL);
+	for (int j = 0; j < prms.size(); j++){
+		if (j == curlbl || (cnts[j] == 0 && j >= this->oldprms.size())){ //dead slots are skipped
+			continue;
+		}
+		if (cnts[j] == 0 && olddists != NULL){
+			//an exact lookup is cheaper than the bound; bnds[j] isn't refreshed, which leaves it a valid (looser) bound
+			if (olddists[j] < mindistsq || (olddists[j] == mindistsq && j < minind)){
+				minind = j;
+				mindistsq = olddists[j];
+			}
+			continue;
+		}
+		double lb = std::max(bnds[j] - bnd.drift[j], 0.0);
+		lb *= lb;
+		double gamma = 0;
+		if (cnts[j] == 0){
+			gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+			lb = Step::revivalDistSq(gamma, this->ages[j]*this->Q, w, lb);
+		}
+		if (lb*(1.0-slack) > mindistsq){
+			continue;
+		}
+		double tmpdistsq = this->obsDistSq(ws, j, idx);
+		bnds[j] = sqrt(tmpdistsq) + bnd.drift[j];
+		if (cnts[j] == 0){
+			tmpdistsq = Step::revivalDistSq(gamma, this->ages[j]*this->Q, w, tmpdistsq);
+		}
+		//ties go to the lowest index, as in the exhaustive search
+		if(tmpdistsq < mindistsq || (tmpdistsq == mindistsq && j < minind)){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+	}
+}
+
+template<class Vec>
+template<class S>
+S& DynMeans<Vec>::startMode(Workspace& ws){
+	if (boost::get<S>(&ws.mode) == NULL){
+		ws.mode = S();
+	}
+	return boost::get<S>(ws.mode);
+}
+
+template<class Vec>
+void DynMeans<Vec>::resetBounds(Workspace& ws) const{
+	BoundedState& bnd = startMode<BoundedState>(ws);
+	//keep the capacity of the previous window (within a factor of two of what is needed) so a reused workspace doesn't regrow
+	const int need = std::max((int)ws.prms.size(), 16);
+	const int prevCap = (this->nObs > 0 ? bnd.bnds.size()/this->nObs : 0);
+	bnd.bndCap = std::max(need, std::min(prevCap, 2*need));
+	bnd.bnds.assign((size_t)this->nObs*bnd.bndCap, 0.0); //0 is a valid lower bound for everything
+	bnd.drift.assign(bnd.bndCap, 0.0);
+	bnd.bndCtrs = ws.prms;
+}
+
+//called whenever prms[j] changes or parameter j gets instantiated/uninstantiated/killed (including when a new parameter takes over slot j)
+template<class Vec>
+void DynMeans<Vec>::paramChanged(Workspace& ws, int j) const{
+	if (this->obsLayout != DENSE_WINDOW){
+		if (j >= ws.pnorms.size()){
+			ws.pnorms.resize(j+1);
+		}
+		ws.pnorms[j] = ws.prms[j].template cast<double>().squaredNorm();
+	}
+	if (this->assignType == BOUNDED){
+		this->shiftBounds(ws, j);
+	} else if (this->assignType == PACKED){
+		this->packParameter(ws, j);
+	} else if (this->assignType == APPROXIMATE){
+		this->updateGraph(ws, j);
+	} else if (this->useGemm()){
+		this->gemmParameter(ws, j);
+	} else if (this->assignType == KDTREE){
+		TreeState& tr = boost::get<TreeState>(ws.mode);
+		if (j >= tr.stale.size()){
+			tr.stale.resize(j+1, 0);
+		}
+		if (!tr.stale[j]){
+			tr.stale[j] = 1;
+			tr.dirty.push_back(j);
+		}
+	}
+}
+
+//loosens the bounds of every point to parameter j by the distance it moved, in O(d)
+template<class Vec>
+void DynMeans<Vec>::shiftBounds(Workspace& ws, int j) const{
+	BoundedState& bnd = boost::get<BoundedState>(ws.mode);
+	if (j >= bnd.bndCtrs.size()){
+		//first time slot j is used in this restart; its bounds are still all 0
+		if (j >= bnd.bndCap){
+			int newCap = std::max(j+1, 2*bnd.bndCap);
+			std::vector<double> newBnds((size_t)this->nObs*newCap, 0.0);
+			for (int i = 0; i < this->nObs; i++){
+				std::copy(bnd.bnds.begin() + (size_t)i*bnd.bndCap, bnd.bnds.begin() + (size_t)(i+1)*bnd.bndCap, newBnds.begin() + (size_t)i*newCap);
+			}
+			bnd.bnds.swap(newBnds);
+			bnd.drift.resize(newCap, 0.0);
+			bnd.bndCap = newCap;
+		}
+		bnd.bndCtrs.push_back(ws.prms[j]);
+		return;
+	}
+	bnd.drift[j] += sqrt(distSq(ws.prms[j], bnd.bndCtrs[j]));
+	bnd.bndCtrs[j] = ws.prms[j];
+}
+
+template<class Vec>
+void DynMeans<Vec>::resetPacked(Workspace& ws) const{
+	PackedState& pk = startMode<PackedState>(ws);
+	pk.pcap = 0;
+	pk.pctrs.clear();
+	pk.pscale.clear();
+	pk.poffset.clear();
+	this->reservePacked(ws, std::max((int)ws.prms.size(), 16));
+	for (int j = 0; j < ws.prms.size(); j++){
+		this->packParameter(ws, j);
+	}
+}
+
+//grows the center-major block to hold at least ncols parameters; unused columns are dead slots
+template<class Vec>
+void DynMeans<Vec>::reservePacked(Workspace& ws, int ncols) const{
+	PackedState& pk = boost::get<PackedState>(ws.mode);
+	if (ncols <= pk.pcap){
+		return;
+	}
+	const int dim = this->obsDim;
+	int newCap = std::max(ncols, 2*pk.pcap);
+	std::vector<Scalar> newCtrs((size_t)dim*newCap, 0);
+	for (int d = 0; d < dim && pk.pcap > 0; d++){
+		std::copy(pk.pctrs.begin() + (size_t)d*pk.pcap, pk.pctrs.begin() + (size_t)(d+1)*pk.pcap, newCtrs.begin() + (size_t)d*newCap);
+	}
+	pk.pctrs.swap(newCtrs);
+	pk.pscale.resize(newCap, 0.0);
+	pk.poffset.resize(newCap, std::numeric_limits<double>::infinity());
+	pk.pdists.resize(newCap);
+	pk.pcap = newCap;
+}
+
+//copies parameter j into the center-major block, along with the scale/offset of its penalized distance:
+//(1, 0) if instantiated, (gamma/(1+gamma), age*Q) if it's an uninstantiated old parameter, (0, inf) if it's a dead slot
+template<class Vec>
+void DynMeans<Vec>::packParameter(Workspace& ws, int j) const{
+	PackedState& pk = boost::get<PackedState>(ws.mode);
+	const int dim = this->obsDim;
+	this->reservePacked(ws, j+1);
+	for (int d = 0; d < dim; d++){
+		pk.pctrs[(size_t)d*pk.pcap + j] = ws.prms[j](d);
+	}
+	this->penalty(ws, j, pk.pscale[j], pk.poffset[j]);
+}
+
+template<class Vec>
+void DynMeans<Vec>::resetGemm(Workspace& ws) const{
+	BatchState& bat = boost::get<BatchState>(ws.mode);
+	const int cap = std::max((int)ws.prms.size(), 16);
+	bat.gctrs.resize(cap, this->obsDim);
+	bat.gnorms.assign(cap, 0.0);
+	bat.gscale.assign(cap, 0.0);
+	bat.goffset.assign(cap, std::numeric_limits<double>::infinity());
+	bat.ggamma.assign(cap, 0.0);
+	for (int j = 0; j < ws.prms.size(); j++){
+		this->gemmParameter(ws, j);
+	}
+}
+
+//copies parameter j, relative to gemmOrigin, into the row-major block of the BATCH matrix product search, along with its
+//squared norm and penalty (and its gamma if it's an uninstantiated old parameter, whose penalty depends on the weight of
+//the observation)
+template<class Vec>
+void DynMeans<Vec>::gemmParameter(Workspace& ws, int j) const{
+	BatchState& bat = boost::get<BatchState>(ws.mode);
+	if (j >= bat.gctrs.rows()){
+		const int newCap = std::max(j+1, 2*(int)bat.gctrs.rows());
+		bat.gctrs.conservativeResize(newCap, Eigen::NoChange);
+		bat.gnorms.resize(newCap, 0.0);
+		bat.gscale.resize(newCap, 0.0);
+		bat.goffset.resize(newCap, std::numeric_limits<double>::infinity());
+		bat.ggamma.resize(newCap, 0.0);
+	}
+	bat.gctrs.row(j) = ws.prms[j].transpose() - this->gemmOrigin;
+	bat.gnorms[j] = bat.gctrs.row(j).template cast<double>().squaredNorm();
+	this->penalty(ws, j, bat.gscale[j], bat.goffset[j]);
+	bat.ggamma[j] = (ws.cnts[j] == 0 && j < this->oldprms.size() ? Step::gamma(this->weights[j], this->ages[j], this->tau) : 0.0);
+}
+
+//the penalized distance to parameter j is scale*||x - prms[j]||^2 + offset, where (scale, offset) is
+//(1, 0) if instantiated, (gamma/(1+gamma), age*Q) if it's an uninstantiated old parameter, (0, inf) if it's a dead slot
+template<class Vec>
+void DynMeans<Vec>::penalty(const Workspace& ws, int j, double& scale, double& offset) const{
+	if (ws.cnts[j] > 0){
+		scale = 1.0;
+		offset = 0.0;
+	} else if (j < this->oldprms.size()){
+		double gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+		scale = gamma/(1.0+gamma);
+		offset = this->ages[j]*this->Q;
+	} else {
+		scale = 0.0;
+		offset = std::numeric_limits<double>::infinity();
+	}
+}
+
+//rebuilds the k-d tree over all live parameters
+template<class Vec>
+void DynMeans<Vec>::rebuildTree(Workspace& ws) const{
+	TreeState& tr = startMode<TreeState>(ws);
+	const int K = ws.prms.size();
+	const int dim = this->obsDim;
+	tr.tpts.resize((size_t)K*dim);
+	tr.tscale.resize(K);
+	tr.toffset.resize(K);
+	tr.tids.clear();
+	for (int j = 0; j < K; j++){
+		this->penalty(ws, j, tr.tscale[j], tr.toffset[j]);
+		if (ws.cnts[j] == 0 && j >= this->oldprms.size()){ //dead slot
+			continue;
+		}
+		Eigen::Map<Eigen::VectorXd>(&tr.tpts[(size_t)j*dim], dim) = ws.prms[j].template cast<double>();
+		tr.tids.push_back(j);
+	}
+	tr.tree.build(tr.tpts.data(), tr.tscale.data(), tr.toffset.data(), tr.tids, dim);
+	tr.stale.assign(K, 0);
+	tr.dirty.clear();
+}
+
+//parameters that changed since the tree was built are excluded from it and scanned linearly;
+//the tree is rebuilt once there are more of those than about sqrt(K)
+template<class Vec>
+void DynMeans<Vec>::nearestParameterTree(Workspace& ws, int idx, int& minind, double& mindistsq) const{
+	TreeState& tr = boost::get<TreeState>(ws.mode);
+	const int K = ws.prms.size();
+	if (tr.dirty.size() > std::max(16.0, sqrt((double)K))){
+		this->rebuildTree(ws);
+	}
+	const Scalar* x = this->obsData + (size_t)idx*this->obsStride;
+	tr.tree.nearest(x, tr.stale.data(), minind, mindistsq);
+	for (int i = 0; i < tr.dirty.size(); i++){
+		const int j = tr.dirty[i];
+		if (ws.cnts[j] == 0 && j >= this->oldprms.size()){ //dead slot
+			continue;
+		}
+		double scale, offset;
+		this->penalty(ws, j, scale, offset);
+		double tmpdistsq = 0;
+		for (int d = 0; d < this->obsDim; d++){
+			double diff = (double)ws.prms[j](d) - (double)x[d];
+			tmpdistsq += diff*diff;
+		}
+		tmpdistsq = scale*tmpdistsq + offset;
+		if (tmpdistsq < mindistsq || (tmpdistsq == mindistsq && j < minind)){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+	}
+}
+
+template<class Vec>
+void DynMeans<Vec>::rebuildGraph(Workspace& ws) const{
+	GraphState& gr = boost::get<GraphState>(ws.mode);
+	ParamDist pd(ws.prms);
+	gr.graph.setParameters(this->graphM, this->graphEfConstruction);
+	gr.graph.clear();
+	gr.graphDead.assign(ws.prms.size(), 0);
+	for (int j = 0; j < ws.prms.size(); j++){
+		if (ws.cnts[j] == 0 && j >= this->oldprms.size()){
+			gr.graphDead[j] = 1;
+		}
+		gr.graph.insert(j, pd, gr.graphRng); //dead slots stay in the graph for navigation
+	}
+	gr.graphChanges = 0;
+}
+
+//the graph keeps its links when parameters move (it reads their current positions), so only births and deaths
+//need work here; a slot reused by a new cluster jumped arbitrarily far and gets relinked
+template<class Vec>
+void DynMeans<Vec>::updateGraph(Workspace& ws, int j) const{
+	GraphState& gr = boost::get<GraphState>(ws.mode);
+	ParamDist pd(ws.prms);
+	if (j >= gr.graphDead.size()){
+		gr.graphDead.resize(j+1, 0);
+	}
+	if (!gr.graph.contains(j)){
+		gr.graph.insert(j, pd, gr.graphRng);
+	} else if (ws.cnts[j] == 0 && j >= this->oldprms.size()){
+		gr.graphDead[j] = 1;
+		gr.graphChanges++;
+	} else if (gr.graphDead[j]){
+		gr.graphDead[j] = 0;
+		gr.graph.reconnect(j, pd);
+		gr.graphChanges++;
+	}
+}
+
+//approximate nearest parameter via the navigable small world graph over the parameters:
+//-the point only leaves its current cluster for a strictly closer one, so the objective still decreases monotonically
+//-a new cluster is only created after an exact scan confirms nothing is within lambda
+//-every 32nd query is checked against an exact scan to estimate the recall
+template<class Vec>
+void DynMeans<Vec>::nearestParameterApprox(Workspace& ws, int idx, int& minind, double& mindistsq) const{
+	GraphState& gr = boost::get<GraphState>(ws.mode);
+	const Eigen::Map<const Vec> x = this->obs(idx);
+	const int curlbl = ws.lbls[idx];
+	if (curlbl != -1){
+		mindistsq = distSq(ws.prms[curlbl], x);
+		minind = curlbl;
+	}
+	QueryDist qd(ws.prms, x);
+	gr.graph.search(qd, this->graphEfSearch, gr.graphCands);
+	for (int i = 0; i < gr.graphCands.size(); i++){
+		const int j = gr.graphCands[i].second;
+		if (j == curlbl || gr.graphDead[j]){
+			continue;
+		}
+		double scale, offset;
+		this->penalty(ws, j, scale, offset);
+		double tmpdistsq = scale*gr.graphCands[i].first + offset;
+		if (tmpdistsq < mindistsq || (tmpdistsq == mindistsq && j < minind)){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+	}
+	if (++gr.nQueries % 32 == 0){
+		int exactind = 0;
+		double exactdistsq = std::numeric_limits<double>::max();
+		this->nearestParameter(ws, idx, exactind, exactdistsq);
+		gr.recallSamples++;
+		if (mindistsq <= exactdistsq){
+			gr.recallHits++;
+		}
+	}
+	if (mindistsq > this->lambda){
+		this->nearestParameter(ws, idx, minind, mindistsq);
+	}
+}
+
+//Sets every instantiated parameter from the per-cluster sufficient statistics kept by assignObservations
+//and returns the objective, in O(K*d) with no pass over the observations
+template<class Vec>
+double DynMeans<Vec>::setParameters(Workspace& ws) const{
+	double objective = 0;
+	for (int i = 0; i < ws.prms.size(); i++){
+		if (ws.cnts[i] > 0){
+			this->updateParameter(ws, i);
+			this->paramChanged(ws, i);
+			objective += this->clusterCost(ws, i);
+		}
+	}
 	return objective;
 }
 
+//sets instantiated parameter i to its optimum given the observations assigned to it
+template<class Vec>
+void DynMeans<Vec>::updateParameter(Workspace& ws, int i) const{
+	const double n = ws.wts[i];
+	if (i < this->oldprms.size()){ //updating an old param
+		double gamma = Step::gamma(this->weights[i], this->ages[i], this->tau);
+		Step::updateOld(ws.prms[i], this->oldprms[i], gamma, ws.sums[i], n);
+	} else { //just setting a new param
+		Step::updateNew(ws.prms[i], ws.sums[i], n);
+	}
+}
+
+//the contribution of instantiated cluster i to the objective at its current parameter:
+//birth (lambda) or revival (Q*age) cost, parameter lag cost, and the weighted squared distances of its observations
+template<class Vec>
+double DynMeans<Vec>::clusterCost(const Workspace& ws, int i) const{
+	const double n = ws.wts[i];
+	double cost = 0;
+	if (i < this->oldprms.size()){
+		//add cost for old clusters - Q, and parameter lag cost
+		double gamma = Step::gamma(this->weights[i], this->ages[i], this->tau);
+		cost += Step::oldCost(ws.prms[i], this->oldprms[i], gamma, this->ages[i]*this->Q);
+	} else {
+		//add cost for new clusters - lambda (no lag cost for new params)
+		cost += this->lambda;
+	}
+	cost += Step::scatterCost(ws.prms[i], ws.sums[i], ws.sumsqs[i], ws.shifts[i], n);
+	return cost;
+}
+
+//Streaming mode: each observation is assigned once, on arrival, to its nearest (penalized) parameter or a new cluster,
+//and that parameter takes an online step towards it. The step size 1/(gamma + n) for old clusters (1/n for new ones)
+//is exactly the batch update (gamma*oldprm + sum)/(gamma + n), so the old parameters' weights/ages/tau are respected.
+//Labels are final when returned; nothing per observation is kept, so memory is O(K*d).
+template<class Vec>
+void DynMeans<Vec>::clusterBatch(const std::vector<Vec>& batch, std::vector<int>& labels){
+	labels.clear();
+	if (batch.empty()){
+		return;
+	}
+	const int dim = batch[0].size();
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && sizeof(Vec) % sizeof(Scalar) == 0){
+		//fixed size vectors are stored contiguously in the std::vector, so view them in place
+		this->clusterBatch(batch[0].data(), batch.size(), dim, sizeof(Vec)/sizeof(Scalar), labels);
+		return;
+	}
+	//dynamic size vectors each own their storage; pack them into the buffer kept between calls
+	this->obsBuffer.resize((size_t)batch.size()*dim);
+	for (int i = 0; i < batch.size(); i++){
+		Eigen::Map<Vec>(&this->obsBuffer[(size_t)i*dim], dim) = batch[i];
+	}
+	this->clusterBatch(&this->obsBuffer[0], batch.size(), dim, dim, labels);
+}
+
+template<class Vec>
+void DynMeans<Vec>::clusterBatch(const Scalar* data, int nObs, int dim, int stride, std::vector<int>& labels){
+	labels.clear();
+	if (nObs <= 0 || data == NULL){
+		return;
+	}
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && dim != Vec::SizeAtCompileTime){
+		std::cout << "libdynmeans: ERROR: observation dimension " << dim << " does not match the vector type (" << Vec::SizeAtCompileTime << ")" << std::endl;
+		return;
+	}
+	Workspace& ws = this->stream;
+	if (!this->streamOpen){
+		//start a new window with the old parameters as uninstantiated placeholders
+		this->clearClusters(ws, dim);
+		this->streamOpen = true;
+	}
+	this->setObservationView(data, nObs, dim, stride);
+	labels.resize(nObs);
+	for (int idx = 0; idx < nObs; idx++){
+		int minind = 0;
+		double mindistsq = std::numeric_limits<double>::max();
+		this->nearestParameter(ws, idx, minind, mindistsq);
+		if (mindistsq > this->lambda){
+			minind = Step::newSlot(ws, this->obs(idx));
+		}
+		ws.cnts[minind]++;
+		this->addObservation(ws, minind, idx, 1);
+		this->updateParameter(ws, minind);
+		//streamed clusters never die mid-window, so updateState will give new cluster i the label nextLbl + (i - #old)
+		labels[idx] = (minind < this->oldprms.size() ? this->oldprmlbls[minind] : this->nextLbl + minind - (int)this->oldprms.size());
+	}
+	this->obsData = NULL;
+}
+
+//closes the streaming window: returns its parameters and objective and advances the chain as cluster() would
+template<class Vec>
+void DynMeans<Vec>::commitWindow(std::vector<Vec>& finalParams, double& finalObj){
+	finalObj = 0;
+	if (!this->streamOpen){
+		//a window without observations: no cluster is instantiated, and every old one ages by a step
+		finalParams = this->oldprms;
+		std::vector<int> noLbls;
+		this->updateState(noLbls, std::vector<double>(this->oldprms.size(), 0.0), this->oldprms);
+		return;
+	}
+	Workspace& ws = this->stream;
+	for (int i = 0; i < ws.prms.size(); i++){
+		if (ws.cnts[i] > 0){
+			finalObj += this->clusterCost(ws, i);
+		}
+	}
+	finalParams = ws.prms;
+	std::vector<int> noLbls;
+	this->updateState(noLbls, ws.wts, ws.prms);
+	this->streamOpen = false;
+}
+
+//Sliding window step. The workspace is carried between steps aligned with the old parameters, so at the start of a step
+//every cluster is old and holds the observations it had at the end of the previous one: expiring an observation just
+//subtracts it from its cluster's statistics, and the parameters are re-derived with the new gamma in O(K*d).
+//The sequential step then only visits observations whose label may change. For each observation, the bounds
+//	upper = sup + sdrift[label] >= distance to its own parameter
+//	lower = slo - sdriftTotal <= sqrt of the cost of any other choice: another parameter (distance, or for an uninstantiated
+//	        old one the smaller of distance and sqrt(penalized distance), in case it is revived) or a new cluster (sqrt(lambda))
+//stay valid as parameters move: sdrift[j] accumulates how far j moved and sdriftTotal the largest move of any parameter
+//per sweep (Hamerly). An observation keeps its label while upper <= lower, i.e. slo - sup >= sdriftTotal + sdrift[label];
+//the per-cluster minimum of slo - sup lets whole clusters be skipped in O(1). Choices that get cheaper without moving
+//(new clusters, old ones emptied during a step, and every uninstantiated old one as it ages at the start of a step)
+//tighten the lower bounds of the observations near them explicitly, see slideAppeared.
+template<class Vec>
+void DynMeans<Vec>::slide(const std::vector<Vec>& added, const std::vector<int>& expired, std::vector<int>& addedIds, 
+		std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	timeval tStart;
+	gettimeofday(&tStart, NULL);
+	addedIds.clear();
+	if (this->assignType != EXHAUSTIVE){
+		std::cout << "libdynmeans: ERROR: slide() supports EXHAUSTIVE assignment only" << std::endl;
+		return;
+	}
+	if (this->streamOpen){
+		std::cout << "libdynmeans: ERROR: Call commitWindow to close the streaming window before calling slide" << std::endl;
+		return;
+	}
+	if (this->Q > this->lambda){
+		//every cluster, even one with observations, is forgotten after one step, so no labels carry over to the next
+		std::cout << "libdynmeans: ERROR: slide() needs Q <= lambda" << std::endl;
+		return;
+	}
+	if (!this->slideOpen && this->slideN > 0){
+		std::cout << "libdynmeans: ERROR: the chain advanced outside slide(); call reset() to start a new sliding window" << std::endl;
+		return;
+	}
+	Workspace& ws = this->slideWs;
+	int dim = this->slideDim;
+	if (!this->slideOpen){
+		dim = (!added.empty() ? added[0].size() : (!this->oldprms.empty() ? this->oldprms[0].size() : 0));
+	}
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && dim != 0 && dim != Vec::SizeAtCompileTime){
+		std::cout << "libdynmeans: ERROR: observation dimension " << dim << " does not match the vector type (" << Vec::SizeAtCompileTime << ")" << std::endl;
+		return;
+	}
+	for (int i = 0; i < added.size(); i++){
+		if (added[i].size() != dim){
+			std::cout << "libdynmeans: ERROR: added observation " << i << " has dimension " << added[i].size() << ", the window has " << dim << std::endl;
+			return;
+		}
+	}
+	std::vector<int> expiredIds(expired);
+	std::sort(expiredIds.begin(), expiredIds.end());
+	for (int i = 0; i < expiredIds.size(); i++){
+		const int id = expiredIds[i];
+		if (!this->slideOpen || id < 0 || id >= ws.lbls.size() || ws.lbls[id] < 0 || (i > 0 && id == expiredIds[i-1])){
+			std::cout << "libdynmeans: ERROR: expired id " << id << " is not in the window" << std::endl;
+			return;
+		}
+	}
+	const int nOld = this->oldprms.size();
+	SlideState& sl = startMode<SlideState>(ws);
+	if (!this->slideOpen){
+		//a new window, with the old parameters as uninstantiated placeholders
+		this->clearClusters(ws, dim);
+		ws.lbls.clear();
+		sl.sup.clear();
+		sl.slo.clear();
+		sl.smpos.clear();
+		sl.sdrift.assign(nOld, 0.0);
+		sl.sdriftIter.assign(nOld, 0.0);
+		sl.sradius.assign(nOld, -std::numeric_limits<double>::max());
+		sl.sminKey.assign(nOld, std::numeric_limits<double>::max());
+		sl.sctrs = this->oldprms;
+		sl.smembers.assign(nOld, std::vector<int>());
+		sl.sdriftTotal = 0;
+		this->slideObs.clear();
+		this->slideFree.clear();
+		this->slideN = 0;
+		this->slideDim = dim;
+	}
+	//expire, then add
+	if (!this->slideObs.empty()){
+		this->setObservationView(&this->slideObs[0], ws.lbls.size(), dim, dim);
+	}
+	for (int i = 0; i < expiredIds.size(); i++){
+		const int id = expiredIds[i];
+		const int j = ws.lbls[id];
+		std::vector<int>& mem = sl.smembers[j];
+		sl.smpos[mem.back()] = sl.smpos[id];
+		mem[sl.smpos[id]] = mem.back();
+		mem.pop_back();
+		ws.cnts[j]--;
+		if (ws.cnts[j] == 0){
+			this->clusterEmptied(ws, j);
+		} else {
+			this->addObservation(ws, j, id, -1);
+		}
+		ws.lbls[id] = -1;
+		this->slideFree.push_back(id);
+		this->slideN--;
+	}
+	std::vector<int> todo;
+	for (int i = 0; i < added.size(); i++){
+		int id;
+		if (!this->slideFree.empty()){
+			id = this->slideFree.back();
+			this->slideFree.pop_back();
+		} else {
+			id = ws.lbls.size();
+			ws.lbls.push_back(-1);
+			sl.sup.push_back(0.0);
+			sl.slo.push_back(0.0);
+			sl.smpos.push_back(-1);
+			this->slideObs.resize(this->slideObs.size() + dim);
+		}
+		Eigen::Map<Vec>(&this->slideObs[(size_t)id*dim], dim) = added[i];
+		addedIds.push_back(id);
+		todo.push_back(id);
+		this->slideN++;
+	}
+	if (!this->slideObs.empty()){
+		this->setObservationView(&this->slideObs[0], ws.lbls.size(), dim, dim);
+	}
+	//re-derive the instantiated parameters for this step
+	for (int j = 0; j < nOld; j++){
+		if (ws.cnts[j] > 0){
+			this->updateParameter(ws, j);
+		}
+		this->slideMoved(ws, j);
+	}
+	this->slideBoundary(ws);
+	//the uninstantiated old parameters aged since the bounds were computed
+	for (int j = 0; j < nOld; j++){
+		if (ws.cnts[j] == 0){
+			this->slideAppeared(ws, j);
+		}
+	}
+	this->slideCollect(ws, todo);
+
+	long nChecked = 0;
+	double obj, prevobj;
+	obj = prevobj = std::numeric_limits<double>::max();
+	do {
+		prevobj = obj;
+		for (int i = 0; i < todo.size(); i++){
+			this->slideCheck(ws, todo[i]);
+		}
+		nChecked += todo.size();
+		obj = this->setParameters(ws);
+		for (int j = 0; j < ws.prms.size(); j++){
+			if (ws.cnts[j] > 0){
+				this->slideMoved(ws, j);
+			}
+		}
+		Step::checkMonotone(obj, prevobj);
+		todo.clear();
+		this->slideBoundary(ws);
+		this->slideCollect(ws, todo);
+	} while (prevobj > obj && !todo.empty());
+
+	//drop the dead new-cluster slots, then advance the chain; updateState keeps the order of the clusters but drops the
+	//permanently dead old ones (never one with observations: it is one step old, and Q <= lambda), so the workspace is
+	//renumbered to match
+	std::vector<int> newIdx(ws.prms.size(), -1);
+	int nxt = 0;
+	for (int j = 0; j < ws.prms.size(); j++){
+		if (j < nOld || ws.cnts[j] > 0){
+			newIdx[j] = nxt++;
+		}
+	}
+	this->slideRemap(ws, newIdx, nxt);
+	std::vector<int> chainLbls(this->oldprmlbls);
+	for (int j = nOld; j < ws.prms.size(); j++){
+		chainLbls.push_back(this->nextLbl + j - nOld);
+	}
+	finalObj = obj;
+	finalParams = ws.prms;
+	std::vector<int> noLbls;
+	this->updateState(noLbls, ws.wts, ws.prms);
+	newIdx.assign(ws.prms.size(), -1);
+	nxt = 0;
+	for (int j = 0; j < ws.prms.size(); j++){
+		if (nxt < this->oldprmlbls.size() && this->oldprmlbls[nxt] == chainLbls[j]){
+			newIdx[j] = nxt++;
+		}
+	}
+	this->slideRemap(ws, newIdx, nxt);
+	this->slideOpen = true;
+	this->obsData = NULL;
+
+	timeval tCur;
+	gettimeofday(&tCur, NULL);
+	tTaken = (double)(tCur.tv_sec - tStart.tv_sec) + (double)(tCur.tv_usec - tStart.tv_usec)/1.0e6;
+	if (verbose){
+		std::cout << "libdynmeans: Slide: +" << added.size() << " -" << expiredIds.size() << " window " << this->slideN 
+			<< " reassigned " << nChecked << " Objective: " << finalObj << std::endl;
+	}
+}
+
+template<class Vec>
+int DynMeans<Vec>::getSlideLabel(int id) const{
+	if (!this->slideOpen || id < 0 || id >= this->slideWs.lbls.size() || this->slideWs.lbls[id] < 0){
+		return -1;
+	}
+	return this->oldprmlbls[this->slideWs.lbls[id]];
+}
+
+//the sequential step for observation idx (as assignObservation with EXHAUSTIVE search), also computing its new bounds
+template<class Vec>
+void DynMeans<Vec>::slideCheck(Workspace& ws, const int idx) const{
+	SlideState& sl = boost::get<SlideState>(ws.mode);
+	//slack guards against rounding in the distance/sqrt/drift arithmetic
+	const double slack = std::max(1.0e-12, 64*(double)std::numeric_limits<Scalar>::epsilon());
+	const int oldlbl = ws.lbls[idx];
+	int minind = 0;
+	double mindistsq = std::numeric_limits<double>::max();
+	//the two smallest lower bounds, so the one of whichever parameter wins can be left out
+	int lbind = -1;
+	double lb1 = std::numeric_limits<double>::max(), lb2 = lb1;
+	for (int j = 0; j < ws.prms.size(); j++){
+		if (ws.cnts[j] == 0 && j >= this->oldprms.size()){ //dead slot
+			continue;
+		}
+		const double distsq = this->obsDistSq(ws, j, idx);
+		double tmpdistsq = distsq;
+		if (ws.cnts[j] == 0){
+			double gamma = Step::gamma(this->weights[j], this->ages[j], this->tau);
+			tmpdistsq = gamma/(gamma+1.0)*distsq + this->ages[j]*this->Q;
+		}
+		const double lb = sqrt(std::min(distsq, tmpdistsq));
+		if (tmpdistsq < mindistsq){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+		if (lb < lb1){
+			lb2 = lb1;
+			lb1 = lb;
+			lbind = j;
+		} else if (lb < lb2){
+			lb2 = lb;
+		}
+	}
+	this->moveObservation(ws, idx, minind, mindistsq);
+	const int lbl = ws.lbls[idx];
+	const bool born = (mindistsq > this->lambda);
+	if (lbl >= sl.sdrift.size()){
+		sl.sdrift.resize(lbl+1);
+		sl.sdriftIter.resize(lbl+1);
+		sl.sradius.resize(lbl+1);
+		sl.sminKey.resize(lbl+1);
+		sl.sctrs.resize(lbl+1);
+		sl.smembers.resize(lbl+1);
+	}
+	if (born){
+		sl.sdrift[lbl] = sl.sdriftIter[lbl] = 0;
+		sl.sradius[lbl] = -std::numeric_limits<double>::max();
+		sl.sminKey[lbl] = std::numeric_limits<double>::max();
+		sl.sctrs[lbl] = ws.prms[lbl];
+		sl.smembers[lbl].clear();
+	} else {
+		this->slideMoved(ws, lbl); //revived
+	}
+	if (oldlbl >= 0 && oldlbl != lbl){
+		std::vector<int>& mem = sl.smembers[oldlbl];
+		sl.smpos[mem.back()] = sl.smpos[idx];
+		mem[sl.smpos[idx]] = mem.back();
+		mem.pop_back();
+		if (ws.cnts[oldlbl] > 0 || oldlbl < this->oldprms.size()){
+			this->slideMoved(ws, oldlbl); //emptied old clusters jump back to their old parameter
+		}
+	}
+	const bool emptied = (oldlbl >= 0 && oldlbl < this->oldprms.size() && ws.cnts[oldlbl] == 0);
+	if (oldlbl != lbl){
+		sl.smpos[idx] = sl.smembers[lbl].size();
+		sl.smembers[lbl].push_back(idx);
+	}
+	double lower = std::min((born || lbind != lbl ? lb1 : lb2), sqrt(this->lambda));
+	sl.sup[idx] = sqrt(this->obsDistSq(ws, lbl, idx))*(1.0+slack) - sl.sdrift[lbl];
+	sl.slo[idx] = lower*(1.0-slack) + sl.sdriftTotal;
+	sl.sradius[lbl] = std::max(sl.sradius[lbl], sl.sup[idx]);
+	sl.sminKey[lbl] = std::min(sl.sminKey[lbl], sl.slo[idx] - sl.sup[idx]);
+	if (born){
+		this->slideAppeared(ws, lbl);
+	}
+	if (emptied){
+		this->slideAppeared(ws, oldlbl);
+	}
+}
+
+//records that prms[j] may have moved
+template<class Vec>
+void DynMeans<Vec>::slideMoved(Workspace& ws, const int j) const{
+	SlideState& sl = boost::get<SlideState>(ws.mode);
+	sl.sdrift[j] += sqrt(distSq(ws.prms[j], sl.sctrs[j]));
+	sl.sctrs[j] = ws.prms[j];
+}
+
+//end of a sweep: every lower bound drops by the largest move of any parameter since the previous boundary
+template<class Vec>
+void DynMeans<Vec>::slideBoundary(Workspace& ws) const{
+	SlideState& sl = boost::get<SlideState>(ws.mode);
+	double maxMove = 0;
+	for (int j = 0; j < ws.prms.size(); j++){
+		maxMove = std::max(maxMove, sl.sdrift[j] - sl.sdriftIter[j]);
+		sl.sdriftIter[j] = sl.sdrift[j];
+	}
+	sl.sdriftTotal += maxMove;
+}
+
+//appends the observations whose bounds no longer prove their label, refreshing the per-cluster summaries of the clusters scanned
+template<class Vec>
+void DynMeans<Vec>::slideCollect(Workspace& ws, std::vector<int>& todo) const{
+	SlideState& sl = boost::get<SlideState>(ws.mode);
+	for (int j = 0; j < ws.prms.size(); j++){
+		const std::vector<int>& mem = sl.smembers[j];
+		const double thr = sl.sdriftTotal + sl.sdrift[j];
+		if (mem.empty() || sl.sminKey[j] >= thr){
+			continue;
+		}
+		double minKey = std::numeric_limits<double>::max(), radius = -std::numeric_limits<double>::max();
+		for (int i = 0; i < mem.size(); i++){
+			const int m = mem[i];
+			const double key = sl.slo[m] - sl.sup[m];
+			if (key < thr){
+				todo.push_back(m);
+			} else {
+				minKey = std::min(minKey, key);
+			}
+			radius = std::max(radius, sl.sup[m]);
+		}
+		sl.sminKey[j] = minKey;
+		sl.sradius[j] = radius;
+	}
+}
+
+//parameter u became cheaper to choose without moving there. An observation of cluster j is at least
+//x = dist(prms[j], prms[u]) - upper from it, so choosing u costs it at least min(x, sqrt(scale*x^2 + offset)) in sqrt units.
+//Lower bounds are capped at sqrt(lambda), so clusters for which that is out of reach even at their radius are skipped
+template<class Vec>
+void DynMeans<Vec>::slideAppeared(Workspace& ws, const int u) const{
+	SlideState& sl = boost::get<SlideState>(ws.mode);
+	const double slack = std::max(1.0e-12, 64*(double)std::numeric_limits<Scalar>::epsilon());
+	double scale, offset;
+	this->penalty(ws, u, scale, offset);
+	const double reach = sqrt(std::max(this->lambda, (this->lambda - offset)/scale));
+	for (int j = 0; j < ws.prms.size(); j++){
+		const std::vector<int>& mem = sl.smembers[j];
+		if (j == u || mem.empty()){
+			continue;
+		}
+		const double dist = sqrt(distSq(ws.prms[j], ws.prms[u]))*(1.0-slack);
+		if (dist - (sl.sradius[j] + sl.sdrift[j]) >= reach){
+			continue;
+		}
+		double minKey = std::numeric_limits<double>::max();
+		for (int i = 0; i < mem.size(); i++){
+			const int m = mem[i];
+			const double x = std::max(dist - (sl.sup[m] + sl.sdrift[j]), 0.0);
+			sl.slo[m] = std::min(sl.slo[m], std::min(x, sqrt(scale*x*x + offset)) + sl.sdriftTotal);
+			minKey = std::min(minKey, sl.slo[m] - sl.sup[m]);
+		}
+		sl.sminKey[j] = minKey;
+	}
+}
+
+//moves cluster j to newIdx[j] (-1 = drop it; it must have no observations), relabelling only the members of moved clusters
+template<class Vec>
+void DynMeans<Vec>::slideRemap(Workspace& ws, const std::vector<int>& newIdx, const int newK) const{
+	SlideState& sl = boost::get<SlideState>(ws.mode);
+	for (int j = 0; j < newIdx.size(); j++){
+		const int k = newIdx[j];
+		if (k < 0 || k == j){
+			continue;
+		}
+		ws.prms[k] = ws.prms[j];
+		ws.cnts[k] = ws.cnts[j];
+		ws.wts[k] = ws.wts[j];
+		ws.sums[k] = ws.sums[j];
+		ws.sumsqs[k] = ws.sumsqs[j];
+		ws.shifts[k] = ws.shifts[j];
+		ws.shiftNorms[k] = ws.shiftNorms[j];
+		sl.sdrift[k] = sl.sdrift[j];
+		sl.sdriftIter[k] = sl.sdriftIter[j];
+		sl.sradius[k] = sl.sradius[j];
+		sl.sminKey[k] = sl.sminKey[j];
+		sl.sctrs[k] = sl.sctrs[j];
+		sl.smembers[k].swap(sl.smembers[j]);
+		for (int i = 0; i < sl.smembers[k].size(); i++){
+			ws.lbls[sl.smembers[k][i]] = k;
+		}
+	}
+	ws.prms.resize(newK);
+	ws.cnts.resize(newK);
+	ws.wts.resize(newK);
+	ws.sums.resize(newK);
+	ws.sumsqs.resize(newK);
+	ws.shifts.resize(newK);
+	ws.shiftNorms.resize(newK);
+	sl.sdrift.resize(newK);
+	sl.sdriftIter.resize(newK);
+	sl.sradius.resize(newK);
+	sl.sminKey.resize(newK);
+	sl.sctrs.resize(newK);
+	sl.smembers.resize(newK);
+	ws.freeSlots.clear();
+}
+
 
 #define __DYNMEANS_IMPL_HPP
 #endif /* __DYNMEANS_IMPL_HPP */
@@ -0,0 +1,288 @@
+#ifndef __DYNMEANS_SIMD_HPP
+#include<limits>
+#include<cstdint>
+#include<cstring>
+//GCC and Clang on x86 compile the AVX2 and AVX-512 kernels whatever the target flags, and simdAvx2/simdAvx512 pick
+//them at run time from the CPU's features (or at compile time, when the target has them, e.g. with -march=native).
+//Other compilers only have them when the target does (e.g. /arch:AVX2)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DYNMEANS_SIMD_X86
+#define DYNMEANS_AVX2
+#define DYNMEANS_AVX512
+#define DYNMEANS_TARGET_AVX2 __attribute__((target("avx2")))
+#define DYNMEANS_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#if defined(__AVX2__)
+#define DYNMEANS_AVX2
+#endif
+#if defined(__AVX512F__)
+#define DYNMEANS_AVX512
+#endif
+#define DYNMEANS_TARGET_AVX2
+#define DYNMEANS_TARGET_AVX512
+#endif
+#if defined(DYNMEANS_AVX2) || defined(DYNMEANS_AVX512)
+#include <immintrin.h>
+#endif
+
+inline bool simdAvx2(){
+#if defined(__AVX2__)
+	return true;
+#elif defined(DYNMEANS_SIMD_X86)
+	static const bool has = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+	return has;
+#else
+	return false;
+#endif
+}
+
+inline bool simdAvx512(){
+#if defined(__AVX512F__)
+	return true;
+#elif defined(DYNMEANS_SIMD_X86)
+	static const bool has = (__builtin_cpu_init(), __builtin_cpu_supports("avx512f"));
+	return has;
+#else
+	return false;
+#endif
+}
+
+//Distance kernel used by DynMeans' PACKED assignment.
+//Computes the penalized squared distances from one point x to K parameters at once:
+//	out[k] = scale[k]*||x - c_k||^2 + offset[k]
+//where the parameters are stored center-major (SoA), i.e. coordinate d of parameter k is ctrs[d*cap + k].
+//The parameters and the point have the scalar type of DynMeans' Vec, and ||x - c_k||^2 is accumulated in it (as Vec's
+//squaredNorm does), so float parameters take half the bandwidth and fill twice the lanes; the penalty is applied in double.
+//Vectorizes across parameters (AVX-512: 8 doubles or 16 floats, AVX2: 4 doubles or 8 floats at a time) on CPUs that have
+//them, with a scalar loop for the remainder and for other CPUs. The vector kernels take parameters k.. and return where
+//they stopped.
+//Dim is the compile-time dimension so the inner loop over coordinates unrolls; Dim <= 0 (Eigen::Dynamic) uses dim.
+#if defined(DYNMEANS_AVX512)
+template<int Dim>
+DYNMEANS_TARGET_AVX512 inline int packedDistancesAvx512(const double* ctrs, const int cap, const double* scale, const double* offset,
+		const double* x, const int dim, const int K, double* out, int k){
+	const int D = (Dim > 0 ? Dim : dim);
+	for (; k + 8 <= K; k += 8){
+		__m512d acc = _mm512_setzero_pd();
+		for (int d = 0; d < D; d++){
+			__m512d diff = _mm512_sub_pd(_mm512_loadu_pd(ctrs + (size_t)d*cap + k), _mm512_set1_pd(x[d]));
+			acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+		}
+		acc = _mm512_add_pd(_mm512_mul_pd(acc, _mm512_loadu_pd(scale + k)), _mm512_loadu_pd(offset + k));
+		_mm512_storeu_pd(out + k, acc);
+	}
+	return k;
+}
+
+template<int Dim>
+DYNMEANS_TARGET_AVX512 inline int packedDistancesAvx512(const float* ctrs, const int cap, const double* scale, const double* offset,
+		const float* x, const int dim, const int K, double* out, int k){
+	const int D = (Dim > 0 ? Dim : dim);
+	for (; k + 16 <= K; k += 16){
+		__m512 acc = _mm512_setzero_ps();
+		for (int d = 0; d < D; d++){
+			__m512 diff = _mm512_sub_ps(_mm512_loadu_ps(ctrs + (size_t)d*cap + k), _mm512_set1_ps(x[d]));
+			acc = _mm512_add_ps(acc, _mm512_mul_ps(diff, diff));
+		}
+		//widen the two halves to double for the penalty (the maskz forms, since the plain ones trip GCC 12's
+		//-Wmaybe-uninitialized in a function that is only AVX-512 by attribute)
+		float lanes[16];
+		_mm512_storeu_ps(lanes, acc);
+		__m512d lo = _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(lanes));
+		__m512d hi = _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(lanes + 8));
+		_mm512_storeu_pd(out + k, _mm512_add_pd(_mm512_mul_pd(lo, _mm512_loadu_pd(scale + k)), _mm512_loadu_pd(offset + k)));
+		_mm512_storeu_pd(out + k + 8, _mm512_add_pd(_mm512_mul_pd(hi, _mm512_loadu_pd(scale + k + 8)), _mm512_loadu_pd(offset + k + 8)));
+	}
+	return k;
+}
+#endif
+
+#if defined(DYNMEANS_AVX2)
+template<int Dim>
+DYNMEANS_TARGET_AVX2 inline int packedDistancesAvx2(const double* ctrs, const int cap, const double* scale, const double* offset,
+		const double* x, const int dim, const int K, double* out, int k){
+	const int D = (Dim > 0 ? Dim : dim);
+	for (; k + 4 <= K; k += 4){
+		__m256d acc = _mm256_setzero_pd();
+		for (int d = 0; d < D; d++){
+			__m256d diff = _mm256_sub_pd(_mm256_loadu_pd(ctrs + (size_t)d*cap + k), _mm256_set1_pd(x[d]));
+			acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+		}
+		acc = _mm256_add_pd(_mm256_mul_pd(acc, _mm256_loadu_pd(scale + k)), _mm256_loadu_pd(offset + k));
+		_mm256_storeu_pd(out + k, acc);
+	}
+	return k;
+}
+
+template<int Dim>
+DYNMEANS_TARGET_AVX2 inline int packedDistancesAvx2(const float* ctrs, const int cap, const double* scale, const double* offset,
+		const float* x, const int dim, const int K, double* out, int k){
+	const int D = (Dim > 0 ? Dim : dim);
+	for (; k + 8 <= K; k += 8){
+		__m256 acc = _mm256_setzero_ps();
+		for (int d = 0; d < D; d++){
+			__m256 diff = _mm256_sub_ps(_mm256_loadu_ps(ctrs + (size_t)d*cap + k), _mm256_set1_ps(x[d]));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+		}
+		//widen the two halves to double for the penalty
+		__m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(acc));
+		__m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(acc, 1));
+		_mm256_storeu_pd(out + k, _mm256_add_pd(_mm256_mul_pd(lo, _mm256_loadu_pd(scale + k)), _mm256_loadu_pd(offset + k)));
+		_mm256_storeu_pd(out + k + 4, _mm256_add_pd(_mm256_mul_pd(hi, _mm256_loadu_pd(scale + k + 4)), _mm256_loadu_pd(offset + k + 4)));
+	}
+	return k;
+}
+#endif
+
+template<int Dim, typename T>
+inline void packedDistances(const T* ctrs, const int cap, const double* scale, const double* offset,
+		const T* x, const int dim, const int K, double* out){
+	const int D = (Dim > 0 ? Dim : dim);
+	int k = 0;
+#if defined(DYNMEANS_AVX512)
+	if (simdAvx512()){
+		k = packedDistancesAvx512<Dim>(ctrs, cap, scale, offset, x, dim, K, out, k);
+	}
+#endif
+#if defined(DYNMEANS_AVX2)
+	if (simdAvx2()){
+		k = packedDistancesAvx2<Dim>(ctrs, cap, scale, offset, x, dim, K, out, k);
+	}
+#endif
+	for (; k < K; k++){
+		T acc = 0;
+		for (int d = 0; d < D; d++){
+			T diff = ctrs[(size_t)d*cap + k] - x[d];
+			acc += diff*diff;
+		}
+		out[k] = scale[k]*acc + offset[k];
+	}
+}
+
+//index of the first minimum of out[0..K), and the minimum itself; minind is untouched if nothing beats mindistsq
+inline void packedArgMin(const double* out, const int K, int& minind, double& mindistsq){
+	for (int k = 0; k < K; k++){
+		if (out[k] < mindistsq){
+			minind = k;
+			mindistsq = out[k];
+		}
+	}
+}
+
+//Kernels used by DynMeans' quantized observations, x = scale*q with int8 codes q and float/double parameters c.
+//quantizedDot computes q.c, widening the codes in registers (AVX2: 8 floats or 4 doubles at a time), accumulating in
+//the precision of c; quantizedNormSq computes q.q exactly in integer arithmetic (AVX2: 16 codes at a time with madd).
+//Both have a scalar loop for the remainder and for other CPUs; the AVX2 kernels add their part to acc and return
+//where they stopped.
+#if defined(DYNMEANS_AVX2)
+DYNMEANS_TARGET_AVX2 inline int quantizedDotAvx2(const int8_t* q, const float* c, const int dim, float& acc){
+	int d = 0;
+	//two accumulators, so consecutive steps don't wait on each other's additions
+	__m256 vacc = _mm256_setzero_ps(), vacc2 = _mm256_setzero_ps();
+	for (; d + 16 <= dim; d += 16){
+		__m128i qb = _mm_loadu_si128((const __m128i*)(q + d));
+		__m256 qv = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(qb));
+		__m256 qv2 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(qb, 8)));
+		vacc = _mm256_add_ps(vacc, _mm256_mul_ps(qv, _mm256_loadu_ps(c + d)));
+		vacc2 = _mm256_add_ps(vacc2, _mm256_mul_ps(qv2, _mm256_loadu_ps(c + d + 8)));
+	}
+	for (; d + 8 <= dim; d += 8){
+		__m256 qv = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(q + d))));
+		vacc = _mm256_add_ps(vacc, _mm256_mul_ps(qv, _mm256_loadu_ps(c + d)));
+	}
+	vacc = _mm256_add_ps(vacc, vacc2);
+	float lanes[8];
+	_mm256_storeu_ps(lanes, vacc);
+	for (int l = 0; l < 8; l++){
+		acc += lanes[l];
+	}
+	return d;
+}
+
+DYNMEANS_TARGET_AVX2 inline int quantizedDotAvx2(const int8_t* q, const double* c, const int dim, double& acc){
+	int d = 0;
+	__m256d vacc = _mm256_setzero_pd(), vacc2 = _mm256_setzero_pd();
+	for (; d + 8 <= dim; d += 8){
+		__m128i qb = _mm_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(q + d)));
+		__m128i qb2 = _mm_cvtepi8_epi32(_mm_srli_si128(_mm_loadl_epi64((const __m128i*)(q + d)), 4));
+		vacc = _mm256_add_pd(vacc, _mm256_mul_pd(_mm256_cvtepi32_pd(qb), _mm256_loadu_pd(c + d)));
+		vacc2 = _mm256_add_pd(vacc2, _mm256_mul_pd(_mm256_cvtepi32_pd(qb2), _mm256_loadu_pd(c + d + 4)));
+	}
+	for (; d + 4 <= dim; d += 4){
+		int32_t packed;
+		std::memcpy(&packed, q + d, 4);
+		__m256d qv = _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(packed)));
+		vacc = _mm256_add_pd(vacc, _mm256_mul_pd(qv, _mm256_loadu_pd(c + d)));
+	}
+	vacc = _mm256_add_pd(vacc, vacc2);
+	double lanes[4];
+	_mm256_storeu_pd(lanes, vacc);
+	for (int l = 0; l < 4; l++){
+		acc += lanes[l];
+	}
+	return d;
+}
+
+DYNMEANS_TARGET_AVX2 inline int quantizedNormSqAvx2(const int8_t* q, const int dim, int64_t& acc){
+	int d = 0;
+	//each 32-bit lane gains at most 2*128^2 per step, so flush to 64 bits every 4096 steps
+	while (d + 16 <= dim){
+		__m256i vacc = _mm256_setzero_si256();
+		for (int steps = 0; steps < 4096 && d + 16 <= dim; steps++, d += 16){
+			__m256i qv = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(q + d)));
+			vacc = _mm256_add_epi32(vacc, _mm256_madd_epi16(qv, qv));
+		}
+		int32_t lanes[8];
+		_mm256_storeu_si256((__m256i*)lanes, vacc);
+		for (int l = 0; l < 8; l++){
+			acc += lanes[l];
+		}
+	}
+	return d;
+}
+#endif
+
+inline float quantizedDot(const int8_t* q, const float* c, const int dim){
+	int d = 0;
+	float acc = 0;
+#if defined(DYNMEANS_AVX2)
+	if (simdAvx2()){
+		d = quantizedDotAvx2(q, c, dim, acc);
+	}
+#endif
+	for (; d < dim; d++){
+		acc += q[d]*c[d];
+	}
+	return acc;
+}
+
+inline double quantizedDot(const int8_t* q, const double* c, const int dim){
+	int d = 0;
+	double acc = 0;
+#if defined(DYNMEANS_AVX2)
+	if (simdAvx2()){
+		d = quantizedDotAvx2(q, c, dim, acc);
+	}
+#endif
+	for (; d < dim; d++){
+		acc += q[d]*c[d];
+	}
+	return acc;
+}
+
+inline int64_t quantizedNormSq(const int8_t* q, const int dim){
+	int d = 0;
+	int64_t acc = 0;
+#if defined(DYNMEANS_AVX2)
+	if (simdAvx2()){
+		d = quantizedNormSqAvx2(q, dim, acc);
+	}
+#endif
+	for (; d < dim; d++){
+		acc += q[d]*q[d];
+	}
+	return acc;
+}
+
+#define __DYNMEANS_SIMD_HPP
+#endif /* __DYNMEANS_SIMD_HPP */
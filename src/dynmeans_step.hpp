@@ -0,0 +1,214 @@
+#ifndef __DYNMEANS_STEP_HPP
+#include<iostream>
+#include<algorithm>
+#include<cmath>
+#include<limits>
+#include <eigen3/Eigen/Dense>
+
+//The per-cluster arithmetic and slot bookkeeping of one Dynamic Means step, shared by DynMeans and MultiDynMeans so
+//both engines compute the same distances, parameters, objective and chain update. A cluster is summarized by n, the total
+//weight of its observations, sum, their weighted sum, and sumsq, their weighted sum of squared distances to the cluster's
+//shift (all in double). The shift is fixed while the slot is open (the old parameter, or the observation that started a
+//new cluster), so sumsq stays on the scale of the cluster's spread even when the coordinates are large, where the raw
+//second moment would cancel against ||sum||^2/n. An old parameter carries gamma = 1/(1/weight + age*tau) into the step
+//and costs ageCost = age*Q to revive.
+template<class Vec>
+class DynMeansStep{
+	public:
+		typedef typename Vec::Scalar Scalar;
+		typedef Eigen::Matrix<double, Vec::RowsAtCompileTime, 1> AccumVec;
+		static double gamma(const double weight, const double age, const double tau);
+		//per unit weight cost of reviving an old parameter at squared distance distsq with a point of weight w
+		static double revivalDistSq(const double gamma, const double ageCost, const double w, const double distsq);
+		//optimum of an old parameter given the observations assigned to it, and of a new one
+		template<class Old> static void updateOld(Vec& prm, const Eigen::MatrixBase<Old>& old, const double gamma, const AccumVec& sum, const double n);
+		static void updateNew(Vec& prm, const AccumVec& sum, const double n);
+		//revival and parameter lag cost of an instantiated old parameter (a new one costs lambda instead)
+		template<class Old> static double oldCost(const Vec& prm, const Eigen::MatrixBase<Old>& old, const double gamma, const double ageCost);
+		//sum_{x in cluster} w_x*||x - prm||^2 = (sumsq - n*||sum/n - shift||^2) + n*||prm - sum/n||^2
+		static double scatterCost(const Vec& prm, const AccumVec& sum, const double sumsq, const AccumVec& shift, const double n);
+		//warns if a Lloyd sweep increased the objective, which the exact assignment and update never do
+		static void checkMonotone(const double obj, const double prevobj);
+
+		//Slot bookkeeping of a restart, on a workspace W with the per-cluster vectors prms, cnts, wts, sums, sumsqs,
+		//shifts and shiftNorms (||shift||^2, for sparse observations), the free list freeSlots, the scratch slotMap and
+		//the observations' labels lbls (-1 = unlabelled). Slots 0..K0-1 hold the old parameters; a new cluster that dies
+		//leaves its slot on freeSlots for the next new one, and compactSlots drops the free slots at the end of the restart.
+		//zero statistics for the K0 old parameters (prms is set by the caller, and is their shift) and no new clusters
+		template<class W> static void clearClusters(W& ws, const int K0, const int dim);
+		//a slot for a new cluster at parameter (and shift) prm, with zero statistics
+		template<class W> static int newSlot(W& ws, const Vec& prm);
+		//adds x with weight w (w < 0 removes it) to the statistics of cluster j
+		template<class W> static void addPoint(W& ws, const int j, const AccumVec& x, const double w);
+		//called when cluster j loses its last observation: resets its statistics exactly (rather than subtracting, so
+		//round-off doesn't build up across cluster lifetimes) and frees its slot if it is a new one; the caller resets
+		//the parameter of an old one
+		template<class W> static void emptyCluster(W& ws, const int j, const int K0);
+		//removes the free slots and relabels the observations
+		template<class W> static void compactSlots(W& ws, const int K0);
+
+		//the chain update of a cluster that got total observation weight wt in the step: a new cluster starts with
+		//weight wt, an instantiated old one carries gamma + wt, and every cluster ages by one step
+		static void advanceCluster(double& weight, int& age, const double wt, const double tau, const bool isNew);
+		//a cluster that has aged this far can never be revived, since it would cost more than a new one
+		static bool permanentlyDead(const int age, const double Q, const double lambda);
+};
+
+template<class Vec>
+double DynMeansStep<Vec>::gamma(const double weight, const double age, const double tau){
+	return 1.0/(1.0/weight + age*tau);
+}
+
+template<class Vec>
+double DynMeansStep<Vec>::revivalDistSq(const double gamma, const double ageCost, const double w, const double distsq){
+	return gamma/(gamma+w)*distsq + ageCost/w;
+}
+
+template<class Vec>
+template<class Old>
+void DynMeansStep<Vec>::updateOld(Vec& prm, const Eigen::MatrixBase<Old>& old, const double gamma, const AccumVec& sum, const double n){
+	prm = ((old.template cast<double>()*gamma + sum)/(gamma + n)).template cast<Scalar>();
+}
+
+template<class Vec>
+void DynMeansStep<Vec>::updateNew(Vec& prm, const AccumVec& sum, const double n){
+	prm = (sum / n).template cast<Scalar>();
+}
+
+template<class Vec>
+template<class Old>
+double DynMeansStep<Vec>::oldCost(const Vec& prm, const Eigen::MatrixBase<Old>& old, const double gamma, const double ageCost){
+	return ageCost + gamma*(prm.template cast<double>() - old.template cast<double>()).squaredNorm();
+}
+
+template<class Vec>
+double DynMeansStep<Vec>::scatterCost(const Vec& prm, const AccumVec& sum, const double sumsq, const AccumVec& shift, const double n){
+	const AccumVec mean = sum/n;
+	//(only round-off can make the scatter negative)
+	double scatter = sumsq - n*(mean - shift).squaredNorm();
+	return std::max(scatter, 0.0) + n*(prm.template cast<double>() - mean).squaredNorm();
+}
+
+template<class Vec>
+void DynMeansStep<Vec>::checkMonotone(const double obj, const double prevobj){
+	if (obj > prevobj + std::max(1.0e-9, (double)std::numeric_limits<Scalar>::epsilon())*fabs(prevobj)){
+		std::cout << "Error: obj > prevobj - monotonicity violated! Check your distance/set parameter functions..." << std::endl;
+		std::cout << "obj: " << obj << " prevobj: " << prevobj << std::endl;
+	}
+}
+
+template<class Vec>
+template<class W>
+void DynMeansStep<Vec>::clearClusters(W& ws, const int K0, const int dim){
+	ws.cnts.assign(K0, 0);
+	ws.wts.assign(K0, 0.0);
+	ws.sums.assign(K0, AccumVec::Zero(dim));
+	ws.sumsqs.assign(K0, 0.0);
+	ws.shifts.resize(K0);
+	ws.shiftNorms.resize(K0);
+	for (int j = 0; j < K0; j++){
+		ws.shifts[j] = ws.prms[j].template cast<double>();
+		ws.shiftNorms[j] = ws.shifts[j].squaredNorm();
+	}
+	ws.freeSlots.clear();
+}
+
+template<class Vec>
+template<class W>
+int DynMeansStep<Vec>::newSlot(W& ws, const Vec& prm){
+	int slot;
+	if (!ws.freeSlots.empty()){
+		slot = ws.freeSlots.back(); //its statistics were zeroed when its cluster died
+		ws.freeSlots.pop_back();
+		ws.prms[slot] = prm;
+		ws.shifts[slot] = prm.template cast<double>();
+	} else {
+		slot = ws.prms.size();
+		ws.prms.push_back(prm);
+		ws.cnts.push_back(0);
+		ws.wts.push_back(0.0);
+		ws.sums.push_back(AccumVec::Zero(prm.size()));
+		ws.sumsqs.push_back(0.0);
+		ws.shifts.push_back(prm.template cast<double>());
+		ws.shiftNorms.push_back(0.0);
+	}
+	ws.shiftNorms[slot] = ws.shifts[slot].squaredNorm();
+	return slot;
+}
+
+template<class Vec>
+template<class W>
+void DynMeansStep<Vec>::addPoint(W& ws, const int j, const AccumVec& x, const double w){
+	ws.wts[j] += w;
+	ws.sums[j] += w*x;
+	ws.sumsqs[j] += w*(x - ws.shifts[j]).squaredNorm();
+}
+
+template<class Vec>
+template<class W>
+void DynMeansStep<Vec>::emptyCluster(W& ws, const int j, const int K0){
+	ws.sums[j].setZero();
+	ws.sumsqs[j] = 0;
+	ws.wts[j] = 0;
+	if (j >= K0){
+		ws.freeSlots.push_back(j);
+	}
+}
+
+template<class Vec>
+template<class W>
+void DynMeansStep<Vec>::compactSlots(W& ws, const int K0){
+	if (ws.freeSlots.empty()){
+		return;
+	}
+	ws.slotMap.assign(ws.prms.size(), -1);
+	int nxt = K0;
+	for (int j = 0; j < ws.prms.size(); j++){
+		if (j < K0){
+			ws.slotMap[j] = j;
+		} else if (ws.cnts[j] > 0){
+			ws.slotMap[j] = nxt;
+			ws.prms[nxt] = ws.prms[j];
+			ws.cnts[nxt] = ws.cnts[j];
+			ws.wts[nxt] = ws.wts[j];
+			ws.sums[nxt] = ws.sums[j];
+			ws.sumsqs[nxt] = ws.sumsqs[j];
+			ws.shifts[nxt] = ws.shifts[j];
+			ws.shiftNorms[nxt] = ws.shiftNorms[j];
+			nxt++;
+		}
+	}
+	ws.prms.resize(nxt);
+	ws.cnts.resize(nxt);
+	ws.wts.resize(nxt);
+	ws.sums.resize(nxt);
+	ws.sumsqs.resize(nxt);
+	ws.shifts.resize(nxt);
+	ws.shiftNorms.resize(nxt);
+	for (int i = 0; i < ws.lbls.size(); i++){
+		if (ws.lbls[i] >= 0){
+			ws.lbls[i] = ws.slotMap[ws.lbls[i]];
+		}
+	}
+	ws.freeSlots.clear();
+}
+
+template<class Vec>
+void DynMeansStep<Vec>::advanceCluster(double& weight, int& age, const double wt, const double tau, const bool isNew){
+	if (isNew){
+		weight = wt;
+		age = 0;
+	} else if (wt > 0){
+		weight = gamma(weight, age, tau) + wt;
+		age = 0;
+	}
+	age++;
+}
+
+template<class Vec>
+bool DynMeansStep<Vec>::permanentlyDead(const int age, const double Q, const double lambda){
+	return age*Q > lambda;
+}
+
+#define __DYNMEANS_STEP_HPP
+#endif /* __DYNMEANS_STEP_HPP */
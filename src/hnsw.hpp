@@ -0,0 +1,260 @@
+#ifndef __HNSW_HPP
+#include<vector>
+#include<queue>
+#include<random>
+#include<cmath>
+#include<algorithm>
+#include<limits>
+
+//Hierarchical navigable small world graph (Malkov & Yashunin) over externally stored points, used by
+//DynMeans' APPROXIMATE assignment. Nodes are integer ids; the graph never stores coordinates, it only asks for distances:
+//	insert/reconnect take pairDist(a, b) between two stored nodes,
+//	search takes queryDist(a) from the query to stored node a.
+//So points may move after insertion (the links just become less ideal), and a node whose point jumped can be reconnected.
+class HNSWGraph{
+	public:
+		HNSWGraph(int M = 16, int efConstruction = 64);
+		void setParameters(int M, int efConstruction);
+		void clear();
+		//adds node id (ids need not be contiguous; missing ids are never visited)
+		template<class PairDist> void insert(int id, const PairDist& pairDist, std::mt19937& rng);
+		//drops the outgoing links of an existing node and links it again from its current position
+		template<class PairDist> void reconnect(int id, const PairDist& pairDist);
+		//the (up to) ef nearest nodes found, sorted by increasing distance
+		template<class QueryDist> void search(const QueryDist& queryDist, int ef, std::vector<std::pair<double, int> >& result);
+		bool contains(int id) const;
+		int size() const;
+	private:
+		typedef std::pair<double, int> DistId;
+		int M, efConstruction;
+		double levelMult;
+		int entry, maxLevel, nNodes;
+		std::vector<int> levels;                          //-1 for ids not in the graph
+		std::vector< std::vector< std::vector<int> > > links; //links[id][level]
+		std::vector<int> visited;                         //visit stamps, so search doesn't clear a bitmap
+		int stamp;
+
+		template<class QueryDist> int greedy(const QueryDist& queryDist, int ep, int level);
+		template<class QueryDist> void searchLayer(const QueryDist& queryDist, int ep, int ef, int level, std::vector<DistId>& result);
+		template<class PairDist> void connect(int id, int level, const PairDist& pairDist);
+		template<class PairDist> void shrink(int id, int level, const PairDist& pairDist);
+		int nextStamp();
+};
+
+inline HNSWGraph::HNSWGraph(int M, int efConstruction){
+	this->setParameters(M, efConstruction);
+	this->clear();
+}
+
+inline void HNSWGraph::setParameters(int M, int efConstruction){
+	this->M = std::max(M, 2);
+	this->efConstruction = std::max(efConstruction, this->M);
+	this->levelMult = 1.0/log((double)this->M);
+}
+
+inline void HNSWGraph::clear(){
+	this->entry = -1;
+	this->maxLevel = -1;
+	this->nNodes = 0;
+	this->levels.clear();
+	this->links.clear();
+	this->visited.clear();
+	this->stamp = 0;
+}
+
+inline bool HNSWGraph::contains(int id) const{
+	return id < this->levels.size() && this->levels[id] >= 0;
+}
+
+inline int HNSWGraph::size() const{
+	return this->nNodes;
+}
+
+inline int HNSWGraph::nextStamp(){
+	if (++this->stamp == std::numeric_limits<int>::max()){
+		std::fill(this->visited.begin(), this->visited.end(), 0);
+		this->stamp = 1;
+	}
+	return this->stamp;
+}
+
+template<class QueryDist>
+int HNSWGraph::greedy(const QueryDist& queryDist, int ep, int level){
+	double epdist = queryDist(ep);
+	bool improved = true;
+	while (improved){
+		improved = false;
+		const std::vector<int>& nbrs = this->links[ep][level];
+		for (int i = 0; i < nbrs.size(); i++){
+			double d = queryDist(nbrs[i]);
+			if (d < epdist){
+				epdist = d;
+				ep = nbrs[i];
+				improved = true;
+			}
+		}
+	}
+	return ep;
+}
+
+template<class QueryDist>
+void HNSWGraph::searchLayer(const QueryDist& queryDist, int ep, int ef, int level, std::vector<DistId>& result){
+	const int stmp = this->nextStamp();
+	std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId> > candidates; //closest first
+	std::priority_queue<DistId> best; //farthest first
+	double epdist = queryDist(ep);
+	candidates.push(DistId(epdist, ep));
+	best.push(DistId(epdist, ep));
+	this->visited[ep] = stmp;
+	while (!candidates.empty()){
+		DistId c = candidates.top();
+		if (c.first > best.top().first && best.size() >= ef){
+			break;
+		}
+		candidates.pop();
+		const std::vector<int>& nbrs = this->links[c.second][level];
+		for (int i = 0; i < nbrs.size(); i++){
+			const int n = nbrs[i];
+			if (this->visited[n] == stmp){
+				continue;
+			}
+			this->visited[n] = stmp;
+			double d = queryDist(n);
+			if (best.size() < ef || d < best.top().first){
+				candidates.push(DistId(d, n));
+				best.push(DistId(d, n));
+				if (best.size() > ef){
+					best.pop();
+				}
+			}
+		}
+	}
+	result.resize(best.size());
+	for (int i = result.size()-1; i >= 0; i--){
+		result[i] = best.top();
+		best.pop();
+	}
+}
+
+template<class QueryDist>
+void HNSWGraph::search(const QueryDist& queryDist, int ef, std::vector<std::pair<double, int> >& result){
+	result.clear();
+	if (this->entry < 0){
+		return;
+	}
+	int ep = this->entry;
+	for (int l = this->maxLevel; l > 0; l--){
+		ep = this->greedy(queryDist, ep, l);
+	}
+	this->searchLayer(queryDist, ep, std::max(ef, 1), 0, result);
+}
+
+//keeps the closest maxLinks neighbours of id at this level
+template<class PairDist>
+void HNSWGraph::shrink(int id, int level, const PairDist& pairDist){
+	std::vector<int>& nbrs = this->links[id][level];
+	const int maxLinks = (level == 0 ? 2*this->M : this->M);
+	if (nbrs.size() <= maxLinks){
+		return;
+	}
+	std::vector<DistId> tmp(nbrs.size());
+	for (int i = 0; i < nbrs.size(); i++){
+		tmp[i] = DistId(pairDist(id, nbrs[i]), nbrs[i]);
+	}
+	std::partial_sort(tmp.begin(), tmp.begin() + maxLinks, tmp.end());
+	nbrs.resize(maxLinks);
+	for (int i = 0; i < maxLinks; i++){
+		nbrs[i] = tmp[i].second;
+	}
+}
+
+//links id into all of its levels, starting the descent from the entry point
+template<class PairDist>
+void HNSWGraph::connect(int id, int level, const PairDist& pairDist){
+	const int self = id;
+	const PairDist& pd = pairDist;
+	auto queryDist = [&pd, self](int a){ return pd(self, a); };
+	int ep = this->entry;
+	for (int l = this->maxLevel; l > level; l--){
+		ep = this->greedy(queryDist, ep, l);
+	}
+	std::vector<DistId> found;
+	for (int l = std::min(level, this->maxLevel); l >= 0; l--){
+		this->searchLayer(queryDist, ep, this->efConstruction, l, found);
+		std::vector<int>& nbrs = this->links[id][l];
+		nbrs.clear();
+		for (int i = 0; i < found.size() && nbrs.size() < this->M; i++){
+			if (found[i].second != id){
+				nbrs.push_back(found[i].second);
+			}
+		}
+		for (int i = 0; i < nbrs.size(); i++){
+			std::vector<int>& back = this->links[nbrs[i]][l];
+			if (std::find(back.begin(), back.end(), id) == back.end()){
+				back.push_back(id);
+				this->shrink(nbrs[i], l, pairDist);
+			}
+		}
+		for (int i = 0; i < found.size(); i++){
+			if (found[i].second != id){
+				ep = found[i].second;
+				break;
+			}
+		}
+	}
+}
+
+template<class PairDist>
+void HNSWGraph::insert(int id, const PairDist& pairDist, std::mt19937& rng){
+	if (this->contains(id)){
+		this->reconnect(id, pairDist);
+		return;
+	}
+	if (id >= this->levels.size()){
+		this->levels.resize(id+1, -1);
+		this->links.resize(id+1);
+		this->visited.resize(id+1, 0);
+	}
+	std::uniform_real_distribution<double> unif(0.0, 1.0);
+	const int level = (int)(-log(1.0 - unif(rng))*this->levelMult);
+	this->levels[id] = level;
+	this->links[id].assign(level+1, std::vector<int>());
+	this->nNodes++;
+	if (this->entry < 0){
+		this->entry = id;
+		this->maxLevel = level;
+		return;
+	}
+	this->connect(id, level, pairDist);
+	if (level > this->maxLevel){
+		this->entry = id;
+		this->maxLevel = level;
+	}
+}
+
+template<class PairDist>
+void HNSWGraph::reconnect(int id, const PairDist& pairDist){
+	if (this->nNodes <= 1){
+		return;
+	}
+	if (id == this->entry){
+		//descend from some other node so the search doesn't start at the node being relinked
+		for (int l = 0; l < this->links[id].size() && this->entry == id; l++){
+			if (!this->links[id][l].empty()){
+				this->entry = this->links[id][l][0];
+				this->maxLevel = this->levels[this->entry];
+			}
+		}
+		if (this->entry == id){
+			return;
+		}
+	}
+	this->connect(id, this->levels[id], pairDist);
+	if (this->levels[id] > this->maxLevel){
+		this->entry = id;
+		this->maxLevel = this->levels[id];
+	}
+}
+
+#define __HNSW_HPP
+#endif /* __HNSW_HPP */
@@ -0,0 +1,186 @@
+#ifndef __KDTREE_HPP
+#include<vector>
+#include<algorithm>
+#include<limits>
+
+//k-d tree over a set of points with a per-point penalized squared distance
+//	f_j(x) = scale[j]*||x - p_j||^2 + offset[j]
+//Used by DynMeans' KDTREE assignment, where p_j are the cluster parameters, scale/offset are (1, 0) for instantiated
+//clusters and (gamma/(1+gamma), age*Q) for uninstantiated old ones. Every node stores its bounding box and the minimum
+//scale/offset below it, so minScale*dist(x, box)^2 + minOffset is a lower bound on f over the subtree and the
+//search stays exact.
+class PenalizedKDTree{
+	public:
+		PenalizedKDTree();
+		//build over the points with ids in ids; point id j has coordinates pts[j*dim .. j*dim+dim)
+		void build(const double* pts, const double* scale, const double* offset, const std::vector<int>& ids, const int dim);
+		//improves (minid, mindistsq) in place with the point minimizing f; ids with skip[id] != 0 are ignored.
+		//ties go to the lowest id
+		template<typename T> void nearest(const T* x, const char* skip, int& minid, double& mindistsq) const;
+		int size() const;
+	private:
+		struct Node{
+			int begin, end;   //range in ids/pts
+			int left, right;  //children (-1 for a leaf)
+			double minScale, minOffset;
+		};
+		static const int leafSize = 8;
+		int dim;
+		std::vector<Node> nodes;
+		std::vector<double> lo, hi; //node bounding boxes, nodes.size() x dim
+		std::vector<int> ids;       //point ids in tree order
+		std::vector<double> pts, scale, offset; //copies in tree order, for locality
+		int buildNode(int begin, int end);
+		template<typename T> void search(const int node, const T* x, const char* skip, int& minid, double& mindistsq) const;
+		template<typename T> double boxBound(const int node, const T* x) const;
+};
+
+inline PenalizedKDTree::PenalizedKDTree(){
+	this->dim = 0;
+}
+
+inline int PenalizedKDTree::size() const{
+	return this->ids.size();
+}
+
+inline void PenalizedKDTree::build(const double* pts, const double* scale, const double* offset, const std::vector<int>& ids, const int dim){
+	this->dim = dim;
+	this->ids = ids;
+	this->nodes.clear();
+	this->lo.clear();
+	this->hi.clear();
+	this->pts.resize(ids.size()*dim);
+	this->scale.resize(ids.size());
+	this->offset.resize(ids.size());
+	for (int i = 0; i < ids.size(); i++){
+		std::copy(pts + (size_t)ids[i]*dim, pts + (size_t)(ids[i]+1)*dim, this->pts.begin() + (size_t)i*dim);
+		this->scale[i] = scale[ids[i]];
+		this->offset[i] = offset[ids[i]];
+	}
+	if (!ids.empty()){
+		this->buildNode(0, ids.size());
+	}
+}
+
+//splits [begin, end) at the median of the widest dimension of its bounding box
+inline int PenalizedKDTree::buildNode(int begin, int end){
+	const int node = this->nodes.size();
+	Node nd;
+	nd.begin = begin;
+	nd.end = end;
+	nd.left = nd.right = -1;
+	nd.minScale = std::numeric_limits<double>::max();
+	nd.minOffset = std::numeric_limits<double>::max();
+	this->nodes.push_back(nd);
+	this->lo.resize(this->lo.size() + this->dim, std::numeric_limits<double>::max());
+	this->hi.resize(this->hi.size() + this->dim, -std::numeric_limits<double>::max());
+	double* nlo = &this->lo[(size_t)node*this->dim];
+	double* nhi = &this->hi[(size_t)node*this->dim];
+	for (int i = begin; i < end; i++){
+		for (int d = 0; d < this->dim; d++){
+			nlo[d] = std::min(nlo[d], this->pts[(size_t)i*this->dim+d]);
+			nhi[d] = std::max(nhi[d], this->pts[(size_t)i*this->dim+d]);
+		}
+		this->nodes[node].minScale = std::min(this->nodes[node].minScale, this->scale[i]);
+		this->nodes[node].minOffset = std::min(this->nodes[node].minOffset, this->offset[i]);
+	}
+	if (end - begin <= leafSize){
+		return node;
+	}
+	int splitDim = 0;
+	for (int d = 1; d < this->dim; d++){
+		if (nhi[d] - nlo[d] > nhi[splitDim] - nlo[splitDim]){
+			splitDim = d;
+		}
+	}
+	//partition a permutation of [begin, end), then apply it to ids/pts/scale/offset
+	const int mid = begin + (end-begin)/2;
+	std::vector<int> perm(end-begin);
+	for (int i = 0; i < perm.size(); i++){
+		perm[i] = begin + i;
+	}
+	const std::vector<double>& p = this->pts;
+	const int dm = this->dim;
+	std::nth_element(perm.begin(), perm.begin() + (mid-begin), perm.end(),
+			[&p, dm, splitDim](int a, int b){return p[(size_t)a*dm+splitDim] < p[(size_t)b*dm+splitDim];});
+	std::vector<int> tids(perm.size());
+	std::vector<double> tpts(perm.size()*dm), tscale(perm.size()), toffset(perm.size());
+	for (int i = 0; i < perm.size(); i++){
+		tids[i] = this->ids[perm[i]];
+		std::copy(p.begin() + (size_t)perm[i]*dm, p.begin() + (size_t)(perm[i]+1)*dm, tpts.begin() + (size_t)i*dm);
+		tscale[i] = this->scale[perm[i]];
+		toffset[i] = this->offset[perm[i]];
+	}
+	std::copy(tids.begin(), tids.end(), this->ids.begin() + begin);
+	std::copy(tpts.begin(), tpts.end(), this->pts.begin() + (size_t)begin*dm);
+	std::copy(tscale.begin(), tscale.end(), this->scale.begin() + begin);
+	std::copy(toffset.begin(), toffset.end(), this->offset.begin() + begin);
+
+	int left = this->buildNode(begin, mid);
+	int right = this->buildNode(mid, end);
+	this->nodes[node].left = left;
+	this->nodes[node].right = right;
+	return node;
+}
+
+template<typename T>
+double PenalizedKDTree::boxBound(const int node, const T* x) const{
+	const double* nlo = &this->lo[(size_t)node*this->dim];
+	const double* nhi = &this->hi[(size_t)node*this->dim];
+	double distsq = 0;
+	for (int d = 0; d < this->dim; d++){
+		double gap = 0;
+		if ((double)x[d] < nlo[d]){
+			gap = nlo[d] - (double)x[d];
+		} else if ((double)x[d] > nhi[d]){
+			gap = (double)x[d] - nhi[d];
+		}
+		distsq += gap*gap;
+	}
+	return this->nodes[node].minScale*distsq + this->nodes[node].minOffset;
+}
+
+template<typename T>
+void PenalizedKDTree::nearest(const T* x, const char* skip, int& minid, double& mindistsq) const{
+	if (!this->nodes.empty()){
+		this->search(0, x, skip, minid, mindistsq);
+	}
+}
+
+template<typename T>
+void PenalizedKDTree::search(const int node, const T* x, const char* skip, int& minid, double& mindistsq) const{
+	const Node& nd = this->nodes[node];
+	if (nd.left < 0){
+		for (int i = nd.begin; i < nd.end; i++){
+			const int id = this->ids[i];
+			if (skip[id]){
+				continue;
+			}
+			double distsq = 0;
+			for (int d = 0; d < this->dim; d++){
+				double diff = this->pts[(size_t)i*this->dim+d] - (double)x[d];
+				distsq += diff*diff;
+			}
+			distsq = this->scale[i]*distsq + this->offset[i];
+			if (distsq < mindistsq || (distsq == mindistsq && id < minid)){
+				minid = id;
+				mindistsq = distsq;
+			}
+		}
+		return;
+	}
+	//visit the child with the smaller bound first; the bound is monotone in the rounding, so pruning on > is exact
+	double lbl = this->boxBound(nd.left, x);
+	double lbr = this->boxBound(nd.right, x);
+	const int first = (lbl <= lbr ? nd.left : nd.right);
+	const int second = (lbl <= lbr ? nd.right : nd.left);
+	if (std::min(lbl, lbr) <= mindistsq){
+		this->search(first, x, skip, minid, mindistsq);
+	}
+	if (std::max(lbl, lbr) <= mindistsq){
+		this->search(second, x, skip, minid, mindistsq);
+	}
+}
+
+#define __KDTREE_HPP
+#endif /* __KDTREE_HPP */
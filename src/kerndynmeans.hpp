@@ -13,6 +13,7 @@
 #include "gurobi_c++.h" //note: the use of this library requires gurobi!
 #include <eigen3/Eigen/Dense>
 #include <eigen3/Eigen/Sparse>
+#include "snapshot.hpp"
 
 using namespace std;
 
@@ -31,6 +32,13 @@ class KernDynMeans{
 		std::vector<int>& finalPrmLbls, double& tTaken);
 		//reset DDP chain
 		void reset();
+		//labels a point against the model of the last step: the label of the old cluster the next step would give it on its
+		//own, or -1 if it would start a new cluster. P provides the point's kernel values: selfSim() with itself,
+		//simToPrm(lbl) with the parameter of the cluster labelled lbl (as simDP in G) and prmSelfSim(lbl) for that parameter
+		//(as selfSimPP). Served from an immutable snapshot published at the end of every step (see snapshot.hpp), so any
+		//number of threads can call it, without locks, while the next step is being clustered
+		template <typename P> int predict(const P& pt) const;
+		template <typename P> void predict(const vector<P>& pts, vector<int>& lbls) const;
 	private:
 		//clusters a refinement level with kernelized dyn means batch updates
 		//template so it works with C/D
@@ -64,6 +72,16 @@ class KernDynMeans{
 		std::vector<int> ages;
 		std::vector<double> agecosts;
 		std::vector<double> gammas;
+
+		//what predict needs from the last step
+		struct Snapshot{
+			vector<int> prmlbls;
+			vector<double> gammas, agecosts;
+			double lambda, sigma;
+		};
+		RCUSnapshot<Snapshot> snapshot;
+		void publishSnapshot();
+		template <typename P> int predictWith(const Snapshot& snap, const P& pt) const;
 };
 
 template <class G>
@@ -43,6 +43,66 @@ void KernDynMeans<G>::reset(){
 	this->gammas.clear();
 	this->agecosts.clear();
 	this->sigma = this->sigmaUB = this->sigmaLB = 0;
+	this->publishSnapshot();
+}
+
+//replaces the model served by predict with the state left by the last step
+template<typename G>
+void KernDynMeans<G>::publishSnapshot(){
+	Snapshot* snap = new Snapshot();
+	snap->prmlbls = this->oldprmlbls;
+	snap->gammas = this->gammas;
+	snap->agecosts = this->agecosts;
+	snap->lambda = this->lambda;
+	snap->sigma = this->sigma;
+	delete this->snapshot.publish(snap);
+}
+
+template<typename G>
+template<typename P>
+int KernDynMeans<G>::predict(const P& pt) const{
+	typename RCUSnapshot<Snapshot>::Reader reader(this->snapshot);
+	if (reader.get() == NULL){
+		return -1;
+	}
+	return this->predictWith(*reader.get(), pt);
+}
+
+template<typename G>
+template<typename P>
+void KernDynMeans<G>::predict(const vector<P>& pts, vector<int>& lbls) const{
+	//one snapshot for the whole batch, so all of it is labelled against the same step
+	typename RCUSnapshot<Snapshot>::Reader reader(this->snapshot);
+	lbls.assign(pts.size(), -1);
+	if (reader.get() == NULL){
+		return;
+	}
+	for (int i = 0; i < pts.size(); i++){
+		lbls[i] = this->predictWith(*reader.get(), pts[i]);
+	}
+}
+
+//the costs updateLabels gives a single node (nct = 1) for reviving an old uninstantiated cluster and for a new cluster;
+//only reads snap, never the members being updated by the clustering thread
+template<typename G>
+template<typename P>
+int KernDynMeans<G>::predictWith(const Snapshot& snap, const P& pt) const{
+	const double selfSim = pt.selfSim() + snap.sigma;
+	double minCost = snap.lambda + snap.sigma;
+	int minLbl = -1;
+	for (int k = 0; k < snap.prmlbls.size(); k++){
+		const double gamma = snap.gammas[k];
+		const int lbl = snap.prmlbls[k];
+		double cost = snap.agecosts[k]
+				+(1.0-1.0/(gamma+1.0))*selfSim
+				+gamma/(gamma+1.0)*(pt.prmSelfSim(lbl) + snap.sigma/gamma)
+				-2.0*gamma/(gamma+1.0)*pt.simToPrm(lbl);
+		if (cost < minCost){
+			minCost = cost;
+			minLbl = lbl;
+		}
+	}
+	return minLbl;
 }
 
 //This function updates the weights/ages of all the clusters after each clustering step is complete
@@ -110,6 +170,7 @@ void KernDynMeans<G>::finalizeStep(const G& aff, const vector<int>& lbls, vector
 		}
 	}
 	prmlbls_out = this->oldprmlbls;//save the parameter labels output 
+	this->publishSnapshot();
 
 	//update this->maxLblPrevUsed if new clusters were created
 	int maxlbl = *max_element(lbls.begin(), lbls.end());
@@ -0,0 +1,111 @@
+#ifndef __MULTIDYNMEANS_HPP
+#include<vector>
+#include<iostream>
+#include<algorithm>
+#include<cmath>
+#include<limits>
+#include<numeric>
+#include<thread>
+#include<atomic>
+#include<cstdint>
+#include<sys/time.h>
+#include <ctime>
+#include <eigen3/Eigen/Dense>
+#include "dynmeans_step.hpp"
+#include "splitmix.hpp"
+
+//Many independent Dynamic Means chains (e.g. one per sensor) sharing lambda, Q and tau, for windows so small (tens to
+//hundreds of observations) that one DynMeans instance per chain would spend most of its time on per-call overhead.
+//The state of all the chains (old parameters, their weights, ages and labels, and each chain's next label) lives in
+//a few contiguous arrays, and one cluster() call runs a whole batch of windows, one per chain, spread over the threads.
+//Each window goes through the same sequential assignment (EXHAUSTIVE search), parameter update and chain update as
+//DynMeans::cluster, in per-thread buffers that are kept between calls, so a batch does no per-window allocation
+//or timing. The restart orderings come from the streams of a DynMeans with the same seed (keyed by the chain's window
+//index and the restart, see splitmix.hpp), so every chain gives exactly the labels and objectives of a
+//DynMeans<Vec>(lambda, Q, tau, false, seed) clustering the same windows, whatever the number of threads and however
+//the windows are batched.
+//Vec must be an Eigen column vector type (fixed or dynamic size) of float or double, as for DynMeans.
+template <class Vec>
+class MultiDynMeans{
+	public:
+		typedef typename Vec::Scalar Scalar;
+		//nChains chains, all starting empty; seed < 0 seeds the restart orderings with the current time
+		MultiDynMeans(int nChains, double lambda, double Q, double tau, int seed = -1);
+		~MultiDynMeans();
+
+		//clusters the next window of each chain in chainIds (distinct ids): window b holds the observations
+		//windowOffsets[b] .. windowOffsets[b+1]-1 (so windowOffsets has chainIds.size()+1 entries), observation i being
+		//the dim Scalars at data[i*stride] (stride = 0 means stride = dim). labels gets the label of every observation
+		//in its chain and windowObjs the objective of every window. An empty window just ages its chain by one step (a step
+		//DynMeans, which refuses empty windows, has no counterpart for). Chains not in chainIds are left as they are
+		void cluster(const std::vector<int>& chainIds, const Scalar* data, const std::vector<int>& windowOffsets, int dim, int stride,
+				int nRestarts, std::vector<int>& labels, std::vector<double>& windowObjs, double& tTaken);
+		void cluster(const std::vector<int>& chainIds, const std::vector<Vec>& observations, const std::vector<int>& windowOffsets,
+				int nRestarts, std::vector<int>& labels, std::vector<double>& windowObjs, double& tTaken);
+		//the old parameters of a chain after its last window, and their labels
+		void getParameters(int chain, std::vector<Vec>& prms, std::vector<int>& prmLbls) const;
+		int getNumChains() const;
+		//reset one chain, or all of them
+		void reset(int chain);
+		void reset();
+		//number of threads the windows of a batch are spread over (1 = serial, 0 = one per hardware thread)
+		void setNumThreads(int nThreads);
+	private:
+		typedef Eigen::Matrix<double, Vec::RowsAtCompileTime, 1> AccumVec;
+		//the per-cluster arithmetic and bookkeeping shared with DynMeans
+		typedef DynMeansStep<Vec> Step;
+		//working variables of one thread, for one window at a time: the restart being run, the best restart so far,
+		//and the old parameters' gamma and revival cost
+		struct Scratch{
+			std::vector<Vec> prms, bestPrms;
+			std::vector<AccumVec> sums, shifts;
+			std::vector<double> wts, sumsqs, shiftNorms, bestWts, gammas, ageCosts;
+			std::vector<int> cnts, lbls, bestLbls, ordering, freeSlots, slotMap;
+		};
+		double lambda, Q, tau;
+		int nThreads;
+		uint64_t seed;
+		int nChains, dim;
+		//state of chain c: its old parameters are entries prmBegin[c] .. prmBegin[c]+prmCount[c]-1 of prms (dim Scalars
+		//each), weights, ages and prmLbls, in a range of prmCap[c] entries that only it uses; nextLbls[c] is its next new
+		//label and steps[c] the number of windows it has seen. capTotal is the sum of the ranges; the arrays also hold the
+		//ranges chains have moved out of, until mergeState compacts them into the next* copies and swaps them in
+		std::vector<int> prmBegin, prmCount, prmCap, nextLbls, steps;
+		int capTotal;
+		std::vector<Scalar> prms;
+		std::vector<double> weights;
+		std::vector<int> ages, prmLbls;
+		std::vector<int> nextPrmBegin;
+		std::vector<Scalar> nextPrms;
+		std::vector<double> nextWeights;
+		std::vector<int> nextAges, nextPrmLbls;
+		//per batch: each chain's window (-1 if it has none), and where each window's updated state goes in the out* arrays
+		//(room for its old parameters plus one new one per observation)
+		std::vector<int> batchIndex, outBegin, outCount, outNextLbls;
+		std::vector<Scalar> outPrms;
+		std::vector<double> outWeights;
+		std::vector<int> outAges, outPrmLbls;
+		std::vector<Scratch> scratch;
+		std::vector<Scalar> obsBuffer;
+
+		//the batch currently being clustered
+		const std::vector<int>* batchChains;
+		const std::vector<int>* batchOffsets;
+		const Scalar* obsData;
+		int obsStride, batchRestarts;
+		std::vector<int>* batchLabels;
+		std::vector<double>* batchObjs;
+
+		Eigen::Map<const Vec> obs(int idx) const;
+		Eigen::Map<const Vec> oldPrm(int c, int j) const;
+		void windowWorker(std::atomic<int>& nextWindow, Scratch& ws);
+		void clusterWindow(Scratch& ws, int b);
+		double runRestart(Scratch& ws, int c, int begin, int n, const uint64_t windowSeed, const int restart) const;
+		void assignObservation(Scratch& ws, int c, int begin, int idx) const;
+		double setParameters(Scratch& ws, int c) const;
+		void updateState(Scratch& ws, int b, int c, int begin, int n);
+		void mergeState();
+};
+#include "multidynmeans_impl.hpp"
+#define __MULTIDYNMEANS_HPP
+#endif /* __MULTIDYNMEANS_HPP */
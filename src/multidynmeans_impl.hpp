@@ -0,0 +1,474 @@
+#ifndef __MULTIDYNMEANS_IMPL_HPP
+template<class Vec>
+MultiDynMeans<Vec>::MultiDynMeans(int nChains, double lambda, double Q, double tau, int seed){
+	this->lambda = lambda;
+	this->Q = Q;
+	this->tau = tau;
+	this->nThreads = 1;
+	if (nChains < 0){
+		std::cout << "libdynmeans: ERROR: Cannot have nChains < 0" << std::endl;
+		nChains = 0;
+	}
+	this->nChains = nChains;
+	//seed the restart orderings with time now (seed < 0) or seed (seed >= 0)
+	this->seed = (seed < 0 ? (uint64_t)std::time(0) : (uint64_t)seed);
+	this->batchChains = this->batchOffsets = NULL;
+	this->obsData = NULL;
+	this->obsStride = this->batchRestarts = 0;
+	this->batchLabels = NULL;
+	this->batchObjs = NULL;
+	this->reset();
+}
+
+template<class Vec>
+MultiDynMeans<Vec>::~MultiDynMeans(){
+}
+
+template<class Vec>
+void MultiDynMeans<Vec>::reset(){
+	this->dim = (Vec::SizeAtCompileTime != Eigen::Dynamic ? Vec::SizeAtCompileTime : 0);
+	this->prmBegin.assign(this->nChains, 0);
+	this->prmCount.assign(this->nChains, 0);
+	this->prmCap.assign(this->nChains, 0);
+	this->capTotal = 0;
+	this->nextLbls.assign(this->nChains, 0);
+	this->steps.assign(this->nChains, 0);
+	this->batchIndex.assign(this->nChains, -1);
+	this->prms.clear();
+	this->weights.clear();
+	this->ages.clear();
+	this->prmLbls.clear();
+}
+
+//the chain keeps its range of the state arrays for its next windows
+template<class Vec>
+void MultiDynMeans<Vec>::reset(int chain){
+	if (chain < 0 || chain >= this->nChains){
+		std::cout << "libdynmeans: ERROR: chain " << chain << " does not exist" << std::endl;
+		return;
+	}
+	this->prmCount[chain] = 0;
+	this->nextLbls[chain] = 0;
+	this->steps[chain] = 0;
+}
+
+template<class Vec>
+void MultiDynMeans<Vec>::setNumThreads(int nThreads){
+	if (nThreads < 0){
+		std::cout << "libdynmeans: ERROR: Cannot have nThreads < 0" << std::endl;
+		return;
+	}
+	if (nThreads == 0){
+		nThreads = std::thread::hardware_concurrency();
+	}
+	this->nThreads = std::max(nThreads, 1);
+}
+
+template<class Vec>
+int MultiDynMeans<Vec>::getNumChains() const{
+	return this->nChains;
+}
+
+template<class Vec>
+void MultiDynMeans<Vec>::getParameters(int chain, std::vector<Vec>& prms, std::vector<int>& prmLbls) const{
+	prms.clear();
+	prmLbls.clear();
+	if (chain < 0 || chain >= this->nChains){
+		std::cout << "libdynmeans: ERROR: chain " << chain << " does not exist" << std::endl;
+		return;
+	}
+	for (int j = 0; j < this->prmCount[chain]; j++){
+		prms.push_back(this->oldPrm(chain, j));
+		prmLbls.push_back(this->prmLbls[this->prmBegin[chain] + j]);
+	}
+}
+
+template<class Vec>
+Eigen::Map<const Vec> MultiDynMeans<Vec>::obs(int idx) const{
+	return Eigen::Map<const Vec>(this->obsData + (size_t)idx*this->obsStride, this->dim);
+}
+
+template<class Vec>
+Eigen::Map<const Vec> MultiDynMeans<Vec>::oldPrm(int c, int j) const{
+	return Eigen::Map<const Vec>(this->prms.data() + (size_t)(this->prmBegin[c] + j)*this->dim, this->dim);
+}
+
+template<class Vec>
+void MultiDynMeans<Vec>::cluster(const std::vector<int>& chainIds, const std::vector<Vec>& observations, const std::vector<int>& windowOffsets,
+		int nRestarts, std::vector<int>& labels, std::vector<double>& windowObjs, double& tTaken){
+	if (windowOffsets.empty() || windowOffsets.back() != observations.size()){
+		std::cout << "libdynmeans: ERROR: windowOffsets must end at the number of observations" << std::endl;
+		return;
+	}
+	const int dim = (observations.empty() ? this->dim : observations[0].size());
+	if (Vec::SizeAtCompileTime != Eigen::Dynamic && sizeof(Vec) % sizeof(Scalar) == 0){
+		//fixed size vectors are stored contiguously in the std::vector, so view them in place
+		this->cluster(chainIds, observations.empty() ? NULL : observations[0].data(), windowOffsets, dim, sizeof(Vec)/sizeof(Scalar),
+				nRestarts, labels, windowObjs, tTaken);
+		return;
+	}
+	//dynamic size vectors each own their storage; pack them once
+	this->obsBuffer.resize((size_t)observations.size()*dim);
+	for (int i = 0; i < observations.size(); i++){
+		Eigen::Map<Vec>(&this->obsBuffer[(size_t)i*dim], dim) = observations[i];
+	}
+	this->cluster(chainIds, this->obsBuffer.data(), windowOffsets, dim, dim, nRestarts, labels, windowObjs, tTaken);
+}
+
+template<class Vec>
+void MultiDynMeans<Vec>::cluster(const std::vector<int>& chainIds, const Scalar* data, const std::vector<int>& windowOffsets, int dim, int stride,
+		int nRestarts, std::vector<int>& labels, std::vector<double>& windowObjs, double& tTaken){
+	timeval tStart;
+	gettimeofday(&tStart, NULL);
+
+	const int nWindows = chainIds.size();
+	if (nRestarts <= 0){
+		std::cout << "libdynmeans: ERROR: Cannot have nRestarts <= 0" << std::endl;
+		return;
+	}
+	if (windowOffsets.size() != nWindows + 1 || windowOffsets[0] != 0){
+		std::cout << "libdynmeans: ERROR: windowOffsets must have chainIds.size()+1 entries, starting at 0" << std::endl;
+		return;
+	}
+	//a batch of empty windows says nothing about the dimension, so it neither checks nor sets it
+	const bool hasObs = (windowOffsets.back() > 0);
+	if (hasObs && this->dim != 0 && dim != this->dim){
+		std::cout << "libdynmeans: ERROR: observation dimension " << dim << " does not match the chains (" << this->dim << ")" << std::endl;
+		return;
+	}
+	if (hasObs && (dim <= 0 || (stride != 0 && stride < dim))){
+		std::cout << "libdynmeans: ERROR: Cannot have dim <= 0 or 0 < stride < dim" << std::endl;
+		return;
+	}
+	if (data == NULL && windowOffsets.back() > 0){
+		std::cout << "libdynmeans: ERROR: data is NULL" << std::endl;
+		return;
+	}
+	for (int b = 0; b < nWindows; b++){
+		const int c = chainIds[b];
+		bool ok = (windowOffsets[b+1] >= windowOffsets[b]);
+		if (!ok){
+			std::cout << "libdynmeans: ERROR: windowOffsets must be nondecreasing" << std::endl;
+		} else if (c < 0 || c >= this->nChains || this->batchIndex[c] >= 0){
+			std::cout << "libdynmeans: ERROR: chain " << c << " does not exist or has two windows in the batch" << std::endl;
+			ok = false;
+		}
+		if (!ok){
+			for (int bb = 0; bb < b; bb++){
+				this->batchIndex[chainIds[bb]] = -1;
+			}
+			return;
+		}
+		this->batchIndex[c] = b;
+	}
+	if (hasObs){
+		this->dim = dim;
+	}
+	this->obsData = data;
+	this->obsStride = (stride == 0 ? dim : stride);
+	this->batchChains = &chainIds;
+	this->batchOffsets = &windowOffsets;
+	this->batchRestarts = nRestarts;
+	this->batchLabels = &labels;
+	this->batchObjs = &windowObjs;
+	labels.resize(windowOffsets.back());
+	windowObjs.resize(nWindows);
+
+	//room for each window's updated state: its old parameters and at most one new one per observation
+	this->outBegin.resize(nWindows);
+	this->outCount.resize(nWindows);
+	this->outNextLbls.resize(nWindows);
+	int outSize = 0;
+	for (int b = 0; b < nWindows; b++){
+		this->outBegin[b] = outSize;
+		outSize += this->prmCount[chainIds[b]] + windowOffsets[b+1] - windowOffsets[b];
+	}
+	this->outPrms.resize((size_t)outSize*this->dim);
+	this->outWeights.resize(outSize);
+	this->outAges.resize(outSize);
+	this->outPrmLbls.resize(outSize);
+
+	//the windows are independent; every thread pulls the next few from nextWindow
+	const int nWorkers = std::max(1, std::min(this->nThreads, nWindows));
+	if (this->scratch.size() < nWorkers){
+		this->scratch.resize(nWorkers);
+	}
+	std::atomic<int> nextWindow(0);
+	if (nWorkers == 1){
+		this->windowWorker(nextWindow, this->scratch[0]);
+	} else {
+		std::vector<std::thread> workers;
+		for (int i = 0; i < nWorkers; i++){
+			workers.push_back(std::thread(&MultiDynMeans<Vec>::windowWorker, this, std::ref(nextWindow), std::ref(this->scratch[i])));
+		}
+		for (int i = 0; i < nWorkers; i++){
+			workers[i].join();
+		}
+	}
+	this->mergeState();
+
+	for (int b = 0; b < nWindows; b++){
+		this->batchIndex[chainIds[b]] = -1;
+	}
+	this->obsData = NULL;
+	this->batchChains = this->batchOffsets = NULL;
+	this->batchLabels = NULL;
+	this->batchObjs = NULL;
+	timeval tCur;
+	gettimeofday(&tCur, NULL);
+	tTaken = (double)(tCur.tv_sec - tStart.tv_sec) + (double)(tCur.tv_usec - tStart.tv_usec)/1.0e6;
+}
+
+template<class Vec>
+void MultiDynMeans<Vec>::windowWorker(std::atomic<int>& nextWindow, Scratch& ws){
+	//a few windows at a time, so tiny windows don't all contend on the counter
+	const int chunk = 8;
+	const int nWindows = this->batchChains->size();
+	for (int b = nextWindow.fetch_add(chunk); b < nWindows; b = nextWindow.fetch_add(chunk)){
+		for (int i = b; i < std::min(b + chunk, nWindows); i++){
+			this->clusterWindow(ws, i);
+		}
+	}
+}
+
+//runs the restarts of window b, keeps the best and writes the chain's updated state to the window's output space
+template<class Vec>
+void MultiDynMeans<Vec>::clusterWindow(Scratch& ws, int b){
+	const int c = (*this->batchChains)[b];
+	const int begin = (*this->batchOffsets)[b];
+	const int n = (*this->batchOffsets)[b+1] - begin;
+	const int K0 = this->prmCount[c];
+	ws.gammas.resize(K0);
+	ws.ageCosts.resize(K0);
+	for (int j = 0; j < K0; j++){
+		const int k = this->prmBegin[c] + j;
+		ws.gammas[j] = Step::gamma(this->weights[k], this->ages[k], this->tau);
+		ws.ageCosts[j] = this->ages[k]*this->Q;
+	}
+	//the window's restart streams are keyed as in DynMeans::nextWindowSeed, by the chain's window index
+	const uint64_t windowSeed = SplitMix64(this->seed, this->steps[c])();
+	double bestObj = std::numeric_limits<double>::max();
+	if (n == 0){
+		//nothing observed: every old cluster stays uninstantiated
+		bestObj = 0;
+		ws.bestPrms.resize(K0);
+		for (int j = 0; j < K0; j++){
+			ws.bestPrms[j] = this->oldPrm(c, j);
+		}
+		ws.bestWts.assign(K0, 0.0);
+		ws.bestLbls.clear();
+	}
+	for (int r = 0; r < this->batchRestarts && n > 0; r++){
+		double obj = this->runRestart(ws, c, begin, n, windowSeed, r);
+		if (obj < bestObj){
+			bestObj = obj;
+			ws.prms.swap(ws.bestPrms);
+			ws.wts.swap(ws.bestWts);
+			ws.lbls.swap(ws.bestLbls);
+		}
+	}
+	(*this->batchObjs)[b] = bestObj;
+	this->updateState(ws, b, c, begin, n);
+}
+
+template<class Vec>
+double MultiDynMeans<Vec>::runRestart(Scratch& ws, int c, int begin, int n, const uint64_t windowSeed, const int restart) const{
+	const int K0 = this->prmCount[c];
+	//the ordering of DynMeans::runRestart, from the restart's own stream
+	SplitMix64 restartRng(windowSeed, restart);
+	ws.ordering.resize(n);
+	std::iota(ws.ordering.begin(), ws.ordering.end(), 0);
+	std::shuffle(ws.ordering.begin(), ws.ordering.end(), restartRng);
+
+	//old parameters are placeholders for the updated ones if they get instantiated, starting with count 0
+	ws.prms.resize(K0);
+	for (int j = 0; j < K0; j++){
+		ws.prms[j] = this->oldPrm(c, j);
+	}
+	Step::clearClusters(ws, K0, this->dim);
+	ws.lbls.assign(n, -1);
+
+	double obj = std::numeric_limits<double>::max(), prevobj;
+	do {
+		prevobj = obj;
+		for (int i = 0; i < n; i++){
+			this->assignObservation(ws, c, begin, ws.ordering[i]);
+		}
+		obj = this->setParameters(ws, c);
+		Step::checkMonotone(obj, prevobj);
+	} while (prevobj > obj);
+	Step::compactSlots(ws, K0);
+	return obj;
+}
+
+//the sequential step of DynMeans (EXHAUSTIVE search) for observation idx of the window starting at begin
+template<class Vec>
+void MultiDynMeans<Vec>::assignObservation(Scratch& ws, int c, int begin, int idx) const{
+	const int K0 = this->prmCount[c];
+	const Eigen::Map<const Vec> x = this->obs(begin + idx);
+	int minind = 0;
+	double mindistsq = std::numeric_limits<double>::max();
+	for (int j = 0; j < ws.prms.size(); j++){
+		if (ws.cnts[j] == 0 && j >= K0){ //dead slot
+			continue;
+		}
+		double tmpdistsq = (ws.prms[j] - x).squaredNorm();
+		if (ws.cnts[j] == 0){ //an uninstantiated old parameter, still at its old value
+			tmpdistsq = Step::revivalDistSq(ws.gammas[j], ws.ageCosts[j], 1.0, tmpdistsq);
+		}
+		if (tmpdistsq < mindistsq){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+	}
+
+	const int oldlbl = ws.lbls[idx];
+	const AccumVec xd = x.template cast<double>();
+	int newlbl = minind;
+	if (mindistsq > this->lambda){
+		//start a new cluster, in the slot of a dead one if there is one
+		newlbl = Step::newSlot(ws, x);
+	} else if (ws.cnts[minind] == 0){
+		//instantiating an old cluster moves its parameter to the optimum given x alone
+		Step::updateOld(ws.prms[minind], this->oldPrm(c, minind), ws.gammas[minind], xd, 1.0);
+	}
+	ws.cnts[newlbl]++;
+	ws.lbls[idx] = newlbl;
+	if (newlbl != oldlbl){
+		Step::addPoint(ws, newlbl, xd, 1.0);
+	}
+	//the old cluster loses x after the assignment, as in DynMeans
+	if (oldlbl != -1){
+		ws.cnts[oldlbl]--;
+		if (ws.cnts[oldlbl] == 0){
+			Step::emptyCluster(ws, oldlbl, K0);
+			if (oldlbl < K0){
+				ws.prms[oldlbl] = this->oldPrm(c, oldlbl);
+			}
+		} else if (newlbl != oldlbl){
+			Step::addPoint(ws, oldlbl, xd, -1.0);
+		}
+	}
+}
+
+//sets every instantiated parameter to its optimum and returns the objective (see DynMeans::clusterCost)
+template<class Vec>
+double MultiDynMeans<Vec>::setParameters(Scratch& ws, int c) const{
+	const int K0 = this->prmCount[c];
+	double objective = 0;
+	for (int i = 0; i < ws.prms.size(); i++){
+		if (ws.cnts[i] == 0){
+			continue;
+		}
+		const double n = ws.wts[i];
+		double cost;
+		if (i < K0){
+			Step::updateOld(ws.prms[i], this->oldPrm(c, i), ws.gammas[i], ws.sums[i], n);
+			cost = Step::oldCost(ws.prms[i], this->oldPrm(c, i), ws.gammas[i], ws.ageCosts[i]);
+		} else {
+			Step::updateNew(ws.prms[i], ws.sums[i], n);
+			cost = this->lambda;
+		}
+		cost += Step::scatterCost(ws.prms[i], ws.sums[i], ws.sumsqs[i], ws.shifts[i], n);
+		objective += cost;
+	}
+	return objective;
+}
+
+//the chain update of DynMeans::updateState for window b of chain c: new weights and ages, labels for the new
+//clusters, the window's labels in chain labels, and the permanently dead clusters dropped; the result goes to the
+//window's output space, and into the state arrays at the next mergeState
+template<class Vec>
+void MultiDynMeans<Vec>::updateState(Scratch& ws, int b, int c, int begin, int n){
+	const int K0 = this->prmCount[c];
+	const int base = this->prmBegin[c];
+	const int nextLbl = this->nextLbls[c];
+	const int K = ws.bestPrms.size();
+	int* lbls = this->batchLabels->data() + begin;
+	for (int i = 0; i < n; i++){
+		const int j = ws.bestLbls[i];
+		lbls[i] = (j < K0 ? this->prmLbls[base + j] : nextLbl + j - K0);
+	}
+	const int o = this->outBegin[b];
+	int cnt = 0;
+	for (int i = 0; i < K; i++){
+		double w = 0;
+		int age = 0, lbl = nextLbl + i - K0;
+		if (i < K0){
+			w = this->weights[base + i];
+			age = this->ages[base + i];
+			lbl = this->prmLbls[base + i];
+		}
+		Step::advanceCluster(w, age, ws.bestWts[i], this->tau, i >= K0);
+		if (Step::permanentlyDead(age, this->Q, this->lambda)){
+			continue;
+		}
+		Eigen::Map<Vec>(this->outPrms.data() + (size_t)(o + cnt)*this->dim, this->dim) = ws.bestPrms[i];
+		this->outWeights[o + cnt] = w;
+		this->outAges[o + cnt] = age;
+		this->outPrmLbls[o + cnt] = lbl;
+		cnt++;
+	}
+	this->outCount[b] = cnt;
+	this->outNextLbls[b] = nextLbl + K - K0;
+}
+
+//writes the updated state of the chains in the batch into their ranges of the state arrays, so a batch costs
+//O(its windows) and the other chains aren't touched. A chain that outgrows its range moves to one twice as large
+//at the end of the arrays; once the ranges left behind take more room than the live ones, the arrays are compacted
+template<class Vec>
+void MultiDynMeans<Vec>::mergeState(){
+	const int nWindows = this->batchChains->size();
+	for (int b = 0; b < nWindows; b++){
+		const int c = (*this->batchChains)[b];
+		const int cnt = this->outCount[b];
+		if (cnt > this->prmCap[c]){
+			const int cap = std::max(cnt, 2*this->prmCap[c]);
+			const size_t end = this->weights.size() + cap;
+			this->prmBegin[c] = this->weights.size();
+			this->capTotal += cap - this->prmCap[c];
+			this->prmCap[c] = cap;
+			this->prms.resize(end*this->dim);
+			this->weights.resize(end);
+			this->ages.resize(end);
+			this->prmLbls.resize(end);
+		}
+		const int k = this->outBegin[b], o = this->prmBegin[c];
+		std::copy(this->outPrms.data() + (size_t)k*this->dim, this->outPrms.data() + (size_t)(k + cnt)*this->dim,
+				this->prms.data() + (size_t)o*this->dim);
+		std::copy(this->outWeights.data() + k, this->outWeights.data() + k + cnt, this->weights.data() + o);
+		std::copy(this->outAges.data() + k, this->outAges.data() + k + cnt, this->ages.data() + o);
+		std::copy(this->outPrmLbls.data() + k, this->outPrmLbls.data() + k + cnt, this->prmLbls.data() + o);
+		this->prmCount[c] = cnt;
+		this->nextLbls[c] = this->outNextLbls[b];
+		this->steps[c]++;
+	}
+	if (this->weights.size() <= 2*(size_t)this->capTotal){
+		return;
+	}
+	//compact: every chain keeps a range of the same size, without the gaps
+	this->nextPrmBegin.resize(this->nChains);
+	this->nextPrms.resize((size_t)this->capTotal*this->dim);
+	this->nextWeights.resize(this->capTotal);
+	this->nextAges.resize(this->capTotal);
+	this->nextPrmLbls.resize(this->capTotal);
+	int o = 0;
+	for (int c = 0; c < this->nChains; c++){
+		const int k = this->prmBegin[c], cnt = this->prmCount[c];
+		std::copy(this->prms.data() + (size_t)k*this->dim, this->prms.data() + (size_t)(k + cnt)*this->dim,
+				this->nextPrms.data() + (size_t)o*this->dim);
+		std::copy(this->weights.data() + k, this->weights.data() + k + cnt, this->nextWeights.data() + o);
+		std::copy(this->ages.data() + k, this->ages.data() + k + cnt, this->nextAges.data() + o);
+		std::copy(this->prmLbls.data() + k, this->prmLbls.data() + k + cnt, this->nextPrmLbls.data() + o);
+		this->nextPrmBegin[c] = o;
+		o += this->prmCap[c];
+	}
+	this->prmBegin.swap(this->nextPrmBegin);
+	this->prms.swap(this->nextPrms);
+	this->weights.swap(this->nextWeights);
+	this->ages.swap(this->nextAges);
+	this->prmLbls.swap(this->nextPrmLbls);
+}
+
+#define __MULTIDYNMEANS_IMPL_HPP
+#endif /* __MULTIDYNMEANS_IMPL_HPP */
@@ -0,0 +1,405 @@
+#ifndef __SHARDED_DYNMEANS_HPP
+#include<vector>
+#include<iostream>
+#include<algorithm>
+#include<limits>
+#include "dynmeans.hpp"
+#include "shards.hpp"
+
+//Sharded DynMeans: clusters the windows of one DynMeans chain with each sweep split across nShards worker processes on
+//this host. The workers are forked by the constructor, once, and kept until the destructor or until the thread that
+//constructed this exits; a shard whose worker is gone runs in this process. Forking copies only the calling thread, so
+//construct this before starting other threads. Every cluster() call copies its window into the workers' shared memory
+//segment (see shards.hpp). In each sweep every shard moves those of its observations whose nearest parameter is a
+//strictly closer instantiated cluster and hands back its partial cluster statistics; this process reduces them in shard
+//order, makes the revival and new-cluster (lambda) decisions for the rest, and broadcasts the new parameters. Later
+//sweeps are those of BATCH assignment; the first sweep takes the unlabelled observations in rounds of doubling size, so
+//that the first clusters exist before most observations are compared. EXHAUSTIVE assignment only, with the restarts
+//run one after another.
+//The chain itself is an ordinary DynMeans, getModel(), for predict(), reset() and the other settings; clustering it
+//directly (or a copy of it) runs in this process
+template <class Vec>
+class ShardedDynMeans{
+	public:
+		ShardedDynMeans(int nShards, double lambda, double Q, double tau, bool verbose = false, int seed = -1);
+		void cluster(const std::vector<Vec>& newobservations, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		void cluster(const std::vector<Vec>& newobservations, const std::vector<double>& obsWeights, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		DynMeans<Vec>& getModel();
+		const DynMeans<Vec>& getModel() const;
+		//number of shards (0 if the workers couldn't be started, and the windows are clustered in this process)
+		int getNumShards() const;
+	private:
+		typedef typename Vec::Scalar Scalar;
+		typedef typename DynMeans<Vec>::AccumVec AccumVec;
+		typedef typename DynMeans<Vec>::Workspace Workspace;
+		typedef typename DynMeans<Vec>::Step Step;
+		DynMeans<Vec> dynm;
+		ShardPool pool;
+		//layout of the shared segment: a header, the labels and ordering of the window (the coordinator's copy during a
+		//sweep), its observations and their weights (if any), the broadcast parameters, their shifts and states and the
+		//gamma and age cost of the old ones (Kcap of each), then one output block per shard: its partial counts/weights/
+		//sums of squares/sums, the observations it moved (index, new label) and those it left for the sequential step.
+		//The workers were forked before the window existed, so they read everything about it from the segment.
+		//Parameter states: dead slot, instantiated, uninstantiated old parameter
+		enum ShardState{
+			SHARD_DEAD,
+			SHARD_INST,
+			SHARD_UNINST
+		};
+		struct ShardHeader{
+			int K, Kcap;
+			int quota;    //unlabelled observations each shard takes this round
+			int newSweep; //first round of a sweep: the labelled observations are processed too
+			int nObs, dim, weighted;
+			double lambda;
+		};
+		struct ShardCounts{
+			int nMoved, nSerial, remaining;
+		};
+		struct ShardLayout{
+			size_t lbls, ordering, obs, obsWts, state, prms, shifts, gammas, ageCosts, shards, shardStride, counts, cnts, wts, sumsqs, sums, moved, serial, total;
+		};
+		struct ShardView{
+			ShardHeader* header;
+			int *lbls, *ordering, *state;
+			Scalar *obs, *prms;
+			double *obsWts, *shifts, *gammas, *ageCosts;
+			ShardCounts* counts;
+			int *cnts, *moved, *serial;
+			double *wts, *sumsqs, *sums;
+		};
+		ShardLayout shardLayout(const ShardHeader& header, int nShards) const;
+		ShardView shardView(int s) const;
+		void clusterWindow(const std::vector<Vec>& newobservations, const std::vector<double>* obsWeights, int nRestarts, std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken);
+		bool shardWindow(const std::vector<Vec>& newobservations, const std::vector<double>* obsWeights);
+		bool reserveShards(int K);
+		void assignObservations(Workspace& ws);
+		void shardRound(int s) const;
+		void shardAssign(const ShardView& v, int idx) const;
+		//the workers run on this instance's segment, so it can't be copied
+		ShardedDynMeans(const ShardedDynMeans&);
+		ShardedDynMeans& operator=(const ShardedDynMeans&);
+};
+
+template<class Vec>
+ShardedDynMeans<Vec>::ShardedDynMeans(int nShards, double lambda, double Q, double tau, bool verbose, int seed) : dynm(lambda, Q, tau, verbose, seed){
+	//(if the pool can't be started, it stays empty and the windows are clustered in this process)
+	this->pool.start(nShards, sizeof(ShardHeader), [this](int s){ this->shardRound(s); });
+}
+
+template<class Vec>
+void ShardedDynMeans<Vec>::cluster(const std::vector<Vec>& newobservations, int nRestarts,
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	this->clusterWindow(newobservations, NULL, nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
+
+template<class Vec>
+void ShardedDynMeans<Vec>::cluster(const std::vector<Vec>& newobservations, const std::vector<double>& obsWeights, int nRestarts,
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	this->clusterWindow(newobservations, &obsWeights, nRestarts, finalLabels, finalParams, finalObj, tTaken);
+}
+
+template<class Vec>
+DynMeans<Vec>& ShardedDynMeans<Vec>::getModel(){
+	return this->dynm;
+}
+
+template<class Vec>
+const DynMeans<Vec>& ShardedDynMeans<Vec>::getModel() const{
+	return this->dynm;
+}
+
+template<class Vec>
+int ShardedDynMeans<Vec>::getNumShards() const{
+	return this->pool.size();
+}
+
+//hands the window to the workers and has the chain's sweeps run through assignObservations for the duration of the
+//call; the input errors are left to DynMeans::cluster
+template<class Vec>
+void ShardedDynMeans<Vec>::clusterWindow(const std::vector<Vec>& newobservations, const std::vector<double>* obsWeights, int nRestarts,
+		std::vector<int>& finalLabels, std::vector<Vec>& finalParams, double& finalObj, double& tTaken){
+	if (this->dynm.assignType != DynMeans<Vec>::EXHAUSTIVE){
+		std::cout << "libdynmeans: ERROR: Sharded clustering supports EXHAUSTIVE assignment only" << std::endl;
+		return;
+	}
+	if (this->shardWindow(newobservations, obsWeights)){
+		this->dynm.shardedSweep = [this](Workspace& ws){ this->assignObservations(ws); };
+	}
+	if (obsWeights != NULL){
+		this->dynm.cluster(newobservations, *obsWeights, nRestarts, finalLabels, finalParams, finalObj, tTaken);
+	} else {
+		this->dynm.cluster(newobservations, nRestarts, finalLabels, finalParams, finalObj, tTaken);
+	}
+	this->dynm.shardedSweep.clear();
+}
+
+//sharded sweep, run in this process as the coordinator. Each round broadcasts the parameters, has every shard search
+//its part of the ordering against them (shardRound), then reduces the shards' partial statistics in shard order, retires
+//the clusters their moves emptied and runs the sequential step on the observations they left over, in the ordering,
+//exactly as BATCH assignment does after its parallel phase. Labelled observations all go in the first round; unlabelled
+//ones (first sweep) go in rounds that double in size.
+template<class Vec>
+void ShardedDynMeans<Vec>::assignObservations(Workspace& ws){
+	const DynMeans<Vec>& dm = this->dynm;
+	if (!this->reserveShards(ws.prms.size())){
+		//the segment can't hold the parameters; sweep in this process
+		for (int i = 0; i < ws.ordering.size(); i++){
+			dm.assignObservation(ws, ws.ordering[i]);
+		}
+		return;
+	}
+	ShardView v = this->shardView(0);
+	std::copy(ws.lbls.begin(), ws.lbls.end(), v.lbls);
+	std::copy(ws.ordering.begin(), ws.ordering.end(), v.ordering);
+	v.header->newSweep = 1;
+	int quota = 64;
+	while (true){
+		const int K = ws.prms.size();
+		if (!this->reserveShards(K)){
+			//the segment can't grow for the clusters the last round created; finish the sweep here
+			v = this->shardView(0);
+			std::copy(v.lbls, v.lbls + dm.nObs, ws.lbls.begin());
+			for (int i = 0; i < ws.ordering.size(); i++){
+				if (ws.lbls[ws.ordering[i]] == -1){
+					dm.assignObservation(ws, ws.ordering[i]);
+				}
+			}
+			return;
+		}
+		v = this->shardView(0);
+		v.header->K = K;
+		v.header->quota = quota;
+		for (int j = 0; j < K; j++){
+			v.state[j] = (ws.cnts[j] > 0 ? SHARD_INST : j < dm.oldprms.size() ? SHARD_UNINST : SHARD_DEAD);
+			Eigen::Map<Vec>(v.prms + (size_t)j*dm.obsDim, dm.obsDim) = ws.prms[j];
+			Eigen::Map<AccumVec>(v.shifts + (size_t)j*dm.obsDim, dm.obsDim) = ws.shifts[j];
+			if (v.state[j] == SHARD_UNINST){
+				v.gammas[j] = Step::gamma(dm.weights[j], dm.ages[j], dm.tau);
+				v.ageCosts[j] = dm.ages[j]*dm.Q;
+			}
+		}
+		this->pool.run();
+
+		//reduce in shard order, so the result doesn't depend on which shard finished first
+		int remaining = 0;
+		for (int s = 0; s < this->pool.size(); s++){
+			ShardView sv = this->shardView(s);
+			for (int k = 0; k < sv.counts->nMoved; k++){
+				v.lbls[sv.moved[2*k]] = sv.moved[2*k+1];
+			}
+			for (int j = 0; j < K; j++){
+				ws.cnts[j] += sv.cnts[j];
+				ws.wts[j] += sv.wts[j];
+				ws.sumsqs[j] += sv.sumsqs[j];
+				ws.sums[j] += Eigen::Map<const AccumVec>(sv.sums + (size_t)j*dm.obsDim, dm.obsDim);
+			}
+			remaining += sv.counts->remaining;
+		}
+		for (int j = 0; j < K; j++){
+			if (v.state[j] == SHARD_INST && ws.cnts[j] == 0){
+				dm.clusterEmptied(ws, j);
+			}
+		}
+		//the sequential step for the observations that revive an old cluster, start a new one or were not labelled
+		for (int s = 0; s < this->pool.size(); s++){
+			ShardView sv = this->shardView(s);
+			for (int k = 0; k < sv.counts->nSerial; k++){
+				const int idx = sv.serial[k];
+				ws.lbls[idx] = v.lbls[idx];
+				dm.assignObservation(ws, idx);
+				v.lbls[idx] = ws.lbls[idx];
+			}
+		}
+		if (remaining == 0){
+			break;
+		}
+		v.header->newSweep = 0;
+		quota = std::min(2*quota, dm.nObs);
+	}
+	std::copy(v.lbls, v.lbls + dm.nObs, ws.lbls.begin());
+}
+
+//one round of shard s, run in its worker process (or in this one if the worker died): reads only the segment (the
+//worker's copy of this object is as it was at construction) and writes only its own output block, which it starts from
+//scratch
+template<class Vec>
+void ShardedDynMeans<Vec>::shardRound(int s) const{
+	ShardView v = this->shardView(s);
+	const int K = v.header->K;
+	const int nObs = v.header->nObs;
+	std::fill(v.cnts, v.cnts + K, 0);
+	std::fill(v.wts, v.wts + K, 0.0);
+	std::fill(v.sumsqs, v.sumsqs + K, 0.0);
+	std::fill(v.sums, v.sums + (size_t)K*v.header->dim, 0.0);
+	v.counts->nMoved = v.counts->nSerial = 0;
+	//shard s takes positions [begin, end) of the ordering
+	const int nShards = this->pool.size();
+	const int begin = (int)((long)nObs*s/nShards), end = (int)((long)nObs*(s+1)/nShards);
+	int unlabelled = 0;
+	for (int pos = begin; pos < end; pos++){
+		const int idx = v.ordering[pos];
+		if (v.lbls[idx] == -1){
+			if (unlabelled++ >= v.header->quota){
+				continue;
+			}
+		} else if (!v.header->newSweep){
+			continue;
+		}
+		this->shardAssign(v, idx);
+	}
+	v.counts->remaining = std::max(unlabelled - v.header->quota, 0);
+}
+
+//the search of DynMeans::nearestParameter against the broadcast parameters; observation idx moves if its nearest is a
+//different, instantiated cluster within lambda, and is left for the sequential step if it would revive or start one
+template<class Vec>
+void ShardedDynMeans<Vec>::shardAssign(const ShardView& v, int idx) const{
+	const int dim = v.header->dim;
+	const Eigen::Map<const Vec> x(v.obs + (size_t)idx*dim, dim);
+	const double w = (v.header->weighted ? v.obsWts[idx] : 1.0);
+	int minind = 0;
+	double mindistsq = std::numeric_limits<double>::max();
+	for (int j = 0; j < v.header->K; j++){
+		if (v.state[j] == SHARD_DEAD){
+			continue;
+		}
+		double tmpdistsq = DynMeans<Vec>::distSq(Eigen::Map<const Vec>(v.prms + (size_t)j*dim, dim), x);
+		if (v.state[j] == SHARD_UNINST){
+			tmpdistsq = Step::revivalDistSq(v.gammas[j], v.ageCosts[j], w, tmpdistsq);
+		}
+		if (tmpdistsq < mindistsq){
+			minind = j;
+			mindistsq = tmpdistsq;
+		}
+	}
+	const int oldlbl = v.lbls[idx];
+	if (minind == oldlbl){
+		return;
+	}
+	if (mindistsq > v.header->lambda/w || v.state[minind] != SHARD_INST){
+		v.serial[v.counts->nSerial++] = idx;
+		return;
+	}
+	v.moved[2*v.counts->nMoved] = idx;
+	v.moved[2*v.counts->nMoved+1] = minind;
+	v.counts->nMoved++;
+	//the statistics are about the coordinator's shifts, so the reduction can add them up
+	const AccumVec xd = x.template cast<double>();
+	v.cnts[minind]++;
+	v.wts[minind] += w;
+	v.sumsqs[minind] += w*(xd - Eigen::Map<const AccumVec>(v.shifts + (size_t)minind*dim, dim)).squaredNorm();
+	Eigen::Map<AccumVec>(v.sums + (size_t)minind*dim, dim) += w*xd;
+	if (oldlbl != -1){
+		v.cnts[oldlbl]--;
+		v.wts[oldlbl] -= w;
+		v.sumsqs[oldlbl] -= w*(xd - Eigen::Map<const AccumVec>(v.shifts + (size_t)oldlbl*dim, dim)).squaredNorm();
+		Eigen::Map<AccumVec>(v.sums + (size_t)oldlbl*dim, dim) -= w*xd;
+	}
+}
+
+template<class Vec>
+typename ShardedDynMeans<Vec>::ShardLayout ShardedDynMeans<Vec>::shardLayout(const ShardHeader& header, int nShards) const{
+	//every block starts on its own cache line, so shards never write to a line another one reads or writes
+	struct Align{
+		static size_t up(size_t bytes){ return (bytes + 63)/64*64; }
+	};
+	const size_t nObs = header.nObs, dim = header.dim, Kcap = header.Kcap;
+	const size_t perShard = (nObs + nShards - 1)/nShards;
+	//the window's part comes first, so that growing Kcap keeps it in place
+	ShardLayout L;
+	L.lbls = Align::up(sizeof(ShardHeader));
+	L.ordering = L.lbls + Align::up(nObs*sizeof(int));
+	L.obs = L.ordering + Align::up(nObs*sizeof(int));
+	L.obsWts = L.obs + Align::up(nObs*dim*sizeof(Scalar));
+	L.state = L.obsWts + Align::up(header.weighted ? nObs*sizeof(double) : 0);
+	L.prms = L.state + Align::up(Kcap*sizeof(int));
+	L.shifts = L.prms + Align::up(Kcap*dim*sizeof(Scalar));
+	L.gammas = L.shifts + Align::up(Kcap*dim*sizeof(double));
+	L.ageCosts = L.gammas + Align::up(Kcap*sizeof(double));
+	L.shards = L.ageCosts + Align::up(Kcap*sizeof(double));
+	//offsets within a shard's block
+	L.counts = 0;
+	L.cnts = Align::up(sizeof(ShardCounts));
+	L.wts = L.cnts + Align::up(Kcap*sizeof(int));
+	L.sumsqs = L.wts + Align::up(Kcap*sizeof(double));
+	L.sums = L.sumsqs + Align::up(Kcap*sizeof(double));
+	L.moved = L.sums + Align::up(Kcap*dim*sizeof(double));
+	L.serial = L.moved + Align::up(2*perShard*sizeof(int));
+	L.shardStride = L.serial + Align::up(perShard*sizeof(int));
+	L.total = L.shards + nShards*L.shardStride;
+	return L;
+}
+
+template<class Vec>
+typename ShardedDynMeans<Vec>::ShardView ShardedDynMeans<Vec>::shardView(int s) const{
+	char* base = this->pool.data();
+	ShardView v;
+	v.header = reinterpret_cast<ShardHeader*>(base);
+	const ShardLayout L = this->shardLayout(*v.header, this->pool.size());
+	v.lbls = reinterpret_cast<int*>(base + L.lbls);
+	v.ordering = reinterpret_cast<int*>(base + L.ordering);
+	v.obs = reinterpret_cast<Scalar*>(base + L.obs);
+	v.obsWts = reinterpret_cast<double*>(base + L.obsWts);
+	v.state = reinterpret_cast<int*>(base + L.state);
+	v.prms = reinterpret_cast<Scalar*>(base + L.prms);
+	v.shifts = reinterpret_cast<double*>(base + L.shifts);
+	v.gammas = reinterpret_cast<double*>(base + L.gammas);
+	v.ageCosts = reinterpret_cast<double*>(base + L.ageCosts);
+	char* block = base + L.shards + s*L.shardStride;
+	v.counts = reinterpret_cast<ShardCounts*>(block + L.counts);
+	v.cnts = reinterpret_cast<int*>(block + L.cnts);
+	v.wts = reinterpret_cast<double*>(block + L.wts);
+	v.sumsqs = reinterpret_cast<double*>(block + L.sumsqs);
+	v.sums = reinterpret_cast<double*>(block + L.sums);
+	v.moved = reinterpret_cast<int*>(block + L.moved);
+	v.serial = reinterpret_cast<int*>(block + L.serial);
+	return v;
+}
+
+//copies the window (observations, weights) and the sizes the workers need into the segment; false if there are no
+//workers, the window is one DynMeans::cluster will refuse, or the segment can't hold it (after printing an error), and
+//the window is then clustered in this process
+template<class Vec>
+bool ShardedDynMeans<Vec>::shardWindow(const std::vector<Vec>& newobservations, const std::vector<double>* obsWeights){
+	if (this->pool.size() == 0 || newobservations.size() == 0 || (obsWeights != NULL && obsWeights->size() != newobservations.size())){
+		return false;
+	}
+	ShardHeader header = ShardHeader();
+	header.nObs = newobservations.size();
+	header.dim = newobservations[0].size();
+	header.weighted = (obsWeights != NULL);
+	header.lambda = this->dynm.lambda;
+	header.Kcap = std::max(64, 2*(int)this->dynm.oldprms.size());
+	if (!this->pool.reserve(this->shardLayout(header, this->pool.size()).total)){
+		return false;
+	}
+	*reinterpret_cast<ShardHeader*>(this->pool.data()) = header;
+	ShardView v = this->shardView(0);
+	for (int i = 0; i < header.nObs; i++){
+		Eigen::Map<Vec>(v.obs + (size_t)i*header.dim, header.dim) = newobservations[i];
+		if (header.weighted){
+			v.obsWts[i] = (*obsWeights)[i];
+		}
+	}
+	return true;
+}
+
+//makes room in the segment for K parameters (doubling the capacity), keeping the window, labels and ordering
+template<class Vec>
+bool ShardedDynMeans<Vec>::reserveShards(int K){
+	ShardHeader header = *reinterpret_cast<ShardHeader*>(this->pool.data());
+	if (K <= header.Kcap){
+		return true;
+	}
+	const int Kcap = std::max(K, 2*header.Kcap);
+	header.Kcap = Kcap;
+	if (!this->pool.reserve(this->shardLayout(header, this->pool.size()).total)){
+		return false;
+	}
+	reinterpret_cast<ShardHeader*>(this->pool.data())->Kcap = Kcap;
+	return true;
+}
+
+#define __SHARDED_DYNMEANS_HPP
+#endif /* __SHARDED_DYNMEANS_HPP */
@@ -0,0 +1,284 @@
+#ifndef __SHARDS_HPP
+#include<vector>
+#include<iostream>
+#include<cerrno>
+#include<cstdio>
+#include<ctime>
+#include<boost/function.hpp>
+#include<fcntl.h>
+#include<unistd.h>
+#include<semaphore.h>
+#include<signal.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/types.h>
+#include<sys/wait.h>
+#ifdef __linux__
+#include<sys/prctl.h>
+#endif
+
+//Pool of worker processes on this host for ShardedDynMeans (see sharded_dynmeans.hpp), and the shared memory segment
+//they exchange data in. The workers are forked from the calling process, so they see its memory as it was at start()
+//(copy-on-write) and only what changes afterwards has to go through the segment. run() has every worker call work(s)
+//for its shard s and waits for all of them; a worker that died has its shard run in the calling process instead, so
+//work(s) must depend only on the segment and the memory shared at start(), and write only its own part of the segment.
+//The segment is a POSIX shared memory object (unlinked as soon as it is created, so nothing is left behind) and can
+//grow between runs; the workers remap it when they see the new size. The start/done handshake uses process-shared
+//semaphores in a separate fixed mapping. POSIX only (link with -lrt on older glibc).
+//The workers belong to the pool that started them, so a pool can't be copied.
+class ShardPool{
+	public:
+		ShardPool();
+		~ShardPool();
+		//forks nWorkers workers that run work(s) on each run(), with a segment of bytes bytes (zero-filled);
+		//false (after printing an error) if the segment or the workers can't be created
+		bool start(int nWorkers, size_t bytes, const boost::function<void(int)>& work);
+		//grows the segment to at least bytes, keeping its contents; false (after printing an error) if it can't.
+		//data() may move
+		bool reserve(size_t bytes);
+		char* data() const;
+		int size() const;
+		//calls work(s) for s = 0..size()-1, each in its worker, and returns when all are done
+		void run();
+		//ends the workers and frees the segment (also done by the destructor)
+		void stop();
+	private:
+		struct Control{
+			size_t bytes;   //current size of the segment
+			int command;
+			//followed by nWorkers start semaphores, then nWorkers done semaphores
+		};
+		enum Command{
+			RUN,
+			EXIT
+		};
+		Control* ctrl;
+		size_t ctrlBytes;
+		int fd;
+		char* seg;
+		size_t segBytes;
+		std::vector<pid_t> pids;
+		std::vector<char> alive;
+		boost::function<void(int)> work;
+
+		sem_t* startSem(int s) const;
+		sem_t* doneSem(int s) const;
+		bool remap();
+		void workerLoop(int s);
+		bool waitDone(int s);
+		ShardPool(const ShardPool&);
+		ShardPool& operator=(const ShardPool&);
+};
+
+inline ShardPool::ShardPool(){
+	this->ctrl = NULL;
+	this->ctrlBytes = 0;
+	this->fd = -1;
+	this->seg = NULL;
+	this->segBytes = 0;
+}
+
+inline ShardPool::~ShardPool(){
+	this->stop();
+}
+
+inline sem_t* ShardPool::startSem(int s) const{
+	return reinterpret_cast<sem_t*>(reinterpret_cast<char*>(this->ctrl) + sizeof(Control)) + s;
+}
+
+inline sem_t* ShardPool::doneSem(int s) const{
+	return this->startSem(this->pids.size() + s);
+}
+
+inline char* ShardPool::data() const{
+	return this->seg;
+}
+
+inline int ShardPool::size() const{
+	return this->pids.size();
+}
+
+inline bool ShardPool::start(int nWorkers, size_t bytes, const boost::function<void(int)>& work){
+	this->stop();
+	if (nWorkers <= 0){
+		std::cout << "libdynmeans: ERROR: Cannot have nWorkers <= 0" << std::endl;
+		return false;
+	}
+	//the name is only needed to create the object; unlinking it right away means it goes away with the last mapping
+	static int nSegments = 0;
+	char name[64];
+	snprintf(name, sizeof(name), "/libdynmeans.%d.%d", (int)getpid(), nSegments++);
+	this->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (this->fd < 0){
+		std::cout << "libdynmeans: ERROR: Cannot create the shared memory segment " << name << std::endl;
+		return false;
+	}
+	shm_unlink(name);
+	this->ctrlBytes = sizeof(Control) + 2*nWorkers*sizeof(sem_t);
+	void* c = mmap(NULL, this->ctrlBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (c == MAP_FAILED){
+		std::cout << "libdynmeans: ERROR: Cannot map the shard control block" << std::endl;
+		close(this->fd);
+		this->fd = -1;
+		return false;
+	}
+	this->ctrl = static_cast<Control*>(c);
+	this->ctrl->bytes = 0;
+	this->ctrl->command = RUN;
+	this->pids.assign(nWorkers, -1);
+	this->alive.assign(nWorkers, 0);
+	for (int s = 0; s < 2*nWorkers; s++){
+		sem_init(this->startSem(s), 1, 0);
+	}
+	if (!this->reserve(bytes)){
+		this->stop();
+		return false;
+	}
+	this->work = work;
+	for (int s = 0; s < nWorkers; s++){
+		pid_t pid = fork();
+		if (pid == 0){
+			this->workerLoop(s); //never returns
+		}
+		if (pid < 0){
+			std::cout << "libdynmeans: ERROR: Cannot fork shard worker " << s << "; its shard runs in this process" << std::endl;
+			continue;
+		}
+		this->pids[s] = pid;
+		this->alive[s] = 1;
+	}
+	return true;
+}
+
+inline bool ShardPool::reserve(size_t bytes){
+	if (bytes <= this->segBytes){
+		return true;
+	}
+	if (ftruncate(this->fd, bytes) != 0){
+		std::cout << "libdynmeans: ERROR: Cannot grow the shared memory segment to " << bytes << " bytes" << std::endl;
+		return false;
+	}
+	this->ctrl->bytes = bytes;
+	if (!this->remap()){
+		std::cout << "libdynmeans: ERROR: Cannot map the shared memory segment (" << bytes << " bytes)" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//maps the segment at its current size (ctrl->bytes); the old mapping stays if that fails
+inline bool ShardPool::remap(){
+	void* p = mmap(NULL, this->ctrl->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	if (p == MAP_FAILED){
+		return false;
+	}
+	if (this->seg != NULL){
+		munmap(this->seg, this->segBytes);
+	}
+	this->seg = static_cast<char*>(p);
+	this->segBytes = this->ctrl->bytes;
+	return true;
+}
+
+//body of worker s: wait for a command, run the shard, signal it's done. Workers only ever leave through _exit, so the
+//copy of the caller's state they were forked with is never destroyed or flushed
+inline void ShardPool::workerLoop(int s){
+#ifdef __linux__
+	prctl(PR_SET_PDEATHSIG, SIGKILL); //don't outlive the caller
+#endif
+	while (true){
+		while (sem_wait(this->startSem(s)) != 0 && errno == EINTR){}
+		if (this->ctrl->command == EXIT){
+			_exit(0);
+		}
+		if (this->segBytes != this->ctrl->bytes && !this->remap()){
+			_exit(1); //the caller runs the shard itself
+		}
+		this->work(s);
+		sem_post(this->doneSem(s));
+	}
+}
+
+//waits for worker s, checking every 50ms that it is still there; false if it died
+inline bool ShardPool::waitDone(int s){
+	while (true){
+		timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += 50000000;
+		if (deadline.tv_nsec >= 1000000000){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		if (sem_timedwait(this->doneSem(s), &deadline) == 0){
+			return true;
+		}
+		if (errno != ETIMEDOUT){
+			continue;
+		}
+		//only a reaped child counts as dead. ECHILD means it can't be reaped here (the host ignores SIGCHLD or reaped
+		//it itself), so then it counts as dead only once it no longer exists
+		pid_t r;
+		while ((r = waitpid(this->pids[s], NULL, WNOHANG)) < 0 && errno == EINTR){}
+		bool gone = (r > 0);
+		if (r < 0 && errno == ECHILD){
+			gone = (kill(this->pids[s], 0) != 0 && errno == ESRCH);
+		}
+		if (gone){
+			this->pids[s] = -1; //reaped, so stop() must not wait for it again
+			return false;
+		}
+	}
+}
+
+inline void ShardPool::run(){
+	this->ctrl->command = RUN;
+	for (int s = 0; s < this->pids.size(); s++){
+		if (this->alive[s]){
+			sem_post(this->startSem(s));
+		}
+	}
+	for (int s = 0; s < this->pids.size(); s++){
+		if (this->alive[s] && !this->waitDone(s)){
+			std::cout << "libdynmeans: ERROR: Shard worker " << s << " exited; its shard runs in this process from now on" << std::endl;
+			this->alive[s] = 0;
+		}
+		if (!this->alive[s]){
+			this->work(s);
+		}
+	}
+}
+
+inline void ShardPool::stop(){
+	if (this->ctrl != NULL){
+		this->ctrl->command = EXIT;
+		for (int s = 0; s < this->pids.size(); s++){
+			if (this->alive[s]){
+				sem_post(this->startSem(s));
+			}
+		}
+		for (int s = 0; s < this->pids.size(); s++){
+			if (this->pids[s] > 0){
+				while (waitpid(this->pids[s], NULL, 0) < 0 && errno == EINTR){}
+			}
+		}
+		for (int s = 0; s < 2*this->pids.size(); s++){
+			sem_destroy(this->startSem(s));
+		}
+		munmap(this->ctrl, this->ctrlBytes);
+		this->ctrl = NULL;
+	}
+	if (this->seg != NULL){
+		munmap(this->seg, this->segBytes);
+		this->seg = NULL;
+		this->segBytes = 0;
+	}
+	if (this->fd >= 0){
+		close(this->fd);
+		this->fd = -1;
+	}
+	this->pids.clear();
+	this->alive.clear();
+}
+
+#define __SHARDS_HPP
+#endif /* __SHARDS_HPP */
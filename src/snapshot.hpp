@@ -0,0 +1,130 @@
+#ifndef __SNAPSHOT_HPP
+#include<atomic>
+#include<thread>
+
+//Read-copy-update cell holding an immutable T, used to serve predictions from the model of the last step while
+//the next one is being clustered. One writer publishes whole new values; any number of readers pin the current one
+//without locks (a reader costs two atomic increments and a load) and the writer gets a replaced value back once
+//every reader that may have seen it is gone, to free or to refill as the next value.
+//Readers are counted per epoch: a reader registers in the counter of the current epoch (retrying if the epoch flipped
+//meanwhile, so it never registers in a counter the writer already drained), and publish() swaps the value in, flips the
+//epoch and waits for the previous epoch's counter to drain before returning the old value.
+//A copy is a new cell holding its own copy of the published value (T must be copy constructible); readers and the
+//value kept for recycling are not shared.
+template<class T>
+class RCUSnapshot{
+	public:
+		RCUSnapshot();
+		RCUSnapshot(const RCUSnapshot& other);
+		~RCUSnapshot();
+		//publishes a copy of other's value and frees the one it replaces; writer only
+		RCUSnapshot& operator=(const RCUSnapshot& other);
+		//takes ownership of next (may be NULL) and hands back the value it replaces, which no reader holds any more
+		//(the caller owns it); single writer only
+		T* publish(T* next);
+		//like publish, but the cell keeps the replaced value, and recycle() hands it back (the caller owns it, NULL if
+		//there is none) to be refilled as the next value, so a writer publishing values of a steady size doesn't allocate
+		void publishRecycling(T* next);
+		T* recycle();
+		//pins the published value for its lifetime; get() is NULL if nothing was published
+		class Reader{
+			public:
+				Reader(const RCUSnapshot& cell);
+				~Reader();
+				const T* get() const;
+			private:
+				const RCUSnapshot& cell;
+				unsigned long epoch;
+				const T* value;
+				Reader(const Reader&);
+				Reader& operator=(const Reader&);
+		};
+	private:
+		std::atomic<T*> current;
+		mutable std::atomic<unsigned long> epoch;
+		mutable std::atomic<long> readers[2];
+		T* spare;
+		//a copy of other's published value (NULL if none)
+		static T* copyValue(const RCUSnapshot& other);
+};
+
+template<class T>
+RCUSnapshot<T>::RCUSnapshot() : current(NULL), epoch(0), spare(NULL){
+	this->readers[0] = this->readers[1] = 0;
+}
+
+template<class T>
+RCUSnapshot<T>::RCUSnapshot(const RCUSnapshot& other) : current(copyValue(other)), epoch(0), spare(NULL){
+	this->readers[0] = this->readers[1] = 0;
+}
+
+template<class T>
+RCUSnapshot<T>::~RCUSnapshot(){
+	delete this->current.load();
+	delete this->spare;
+}
+
+template<class T>
+RCUSnapshot<T>& RCUSnapshot<T>::operator=(const RCUSnapshot& other){
+	if (this != &other){
+		delete this->publish(copyValue(other));
+	}
+	return *this;
+}
+
+template<class T>
+T* RCUSnapshot<T>::copyValue(const RCUSnapshot& other){
+	Reader r(other);
+	return (r.get() != NULL ? new T(*r.get()) : NULL);
+}
+
+template<class T>
+T* RCUSnapshot<T>::publish(T* next){
+	T* old = this->current.exchange(next);
+	const unsigned long e = this->epoch.fetch_add(1);
+	//readers that register from now on see next; wait out the ones registered in epoch e
+	while (this->readers[e & 1].load() != 0){
+		std::this_thread::yield();
+	}
+	return old;
+}
+
+template<class T>
+void RCUSnapshot<T>::publishRecycling(T* next){
+	T* old = this->publish(next);
+	delete this->spare;
+	this->spare = old;
+}
+
+template<class T>
+T* RCUSnapshot<T>::recycle(){
+	T* s = this->spare;
+	this->spare = NULL;
+	return s;
+}
+
+template<class T>
+RCUSnapshot<T>::Reader::Reader(const RCUSnapshot& cell) : cell(cell){
+	while (true){
+		this->epoch = cell.epoch.load();
+		cell.readers[this->epoch & 1].fetch_add(1);
+		if (cell.epoch.load() == this->epoch){
+			break;
+		}
+		cell.readers[this->epoch & 1].fetch_sub(1);
+	}
+	this->value = cell.current.load();
+}
+
+template<class T>
+RCUSnapshot<T>::Reader::~Reader(){
+	this->cell.readers[this->epoch & 1].fetch_sub(1);
+}
+
+template<class T>
+const T* RCUSnapshot<T>::Reader::get() const{
+	return this->value;
+}
+
+#define __SNAPSHOT_HPP
+#endif /* __SNAPSHOT_HPP */
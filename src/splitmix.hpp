@@ -0,0 +1,40 @@
+#ifndef __SPLITMIX_HPP
+#include<cstdint>
+
+//SplitMix64 (Steele, Lea and Flood, 2014), the random stream behind the restart orderings: its whole state is one word,
+//so starting a stream costs nothing and allocates nothing. A stream is keyed by a pair of words, its state starting at
+//a hash of both: DynMeans keys window w of a chain by (seed, w) and restart r of a window by (the window's seed, r), so
+//every restart has its own stream, fixed by the seed alone, whatever thread runs it. MultiDynMeans keys each of its
+//chains the same way, so a chain follows the orderings of a DynMeans with the same seed.
+//Meets the UniformRandomBitGenerator requirements, for std::shuffle and the <random> distributions
+class SplitMix64{
+	public:
+		typedef uint64_t result_type;
+		SplitMix64(const uint64_t key, const uint64_t index);
+		result_type operator()();
+		static constexpr result_type min(){ return 0; }
+		static constexpr result_type max(){ return ~(result_type)0; }
+		//the output function: a bijective mix of the 64 bits of z
+		static uint64_t mix(uint64_t z);
+	private:
+		uint64_t state;
+};
+
+inline SplitMix64::SplitMix64(const uint64_t key, const uint64_t index){
+	//(mix is a bijection, so distinct indices of a key start at distinct states, scattered over the period of 2^64)
+	this->state = mix(mix(key) ^ index);
+}
+
+inline uint64_t SplitMix64::operator()(){
+	this->state += 0x9e3779b97f4a7c15ull;
+	return mix(this->state);
+}
+
+inline uint64_t SplitMix64::mix(uint64_t z){
+	z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+#define __SPLITMIX_HPP
+#endif /* __SPLITMIX_HPP */